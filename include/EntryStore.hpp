@@ -0,0 +1,127 @@
+#pragma once
+
+#include "TagIndex.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class MetadataStore;
+
+// Dense, id-indexed column store for memory entries. Ids come from a monotonic
+// counter, so lookups are array indexing. Roles are interned into a small fixed
+// table and contents live in an append-only arena of chunks that never move,
+// so a content pointer stays valid for the lifetime of the store (until clear()).
+// Each entry's JSON object is serialized once when it is stored and kept in the
+// arena too, so responses are built by concatenating fragments. An entry's tags
+// are kept in the arena as one '\0'-separated string, and indexed by tag in
+// bitmaps of ids. Timestamps normally grow with ids, so the timestamp column
+// doubles as a sorted time index, and each role keeps a bitmap of its ids.
+class EntryStore
+{
+public:
+    static constexpr uint8_t NO_ENTRY = 0xFF;
+    static constexpr size_t MAX_ROLES = NO_ENTRY;
+
+    EntryStore() = default;
+    EntryStore(const EntryStore &) = delete;
+    EntryStore &operator=(const EntryStore &) = delete;
+
+    // Throws std::runtime_error if more than MAX_ROLES distinct roles are used, and
+    // std::invalid_argument if a tag is empty or contains '\0'.
+    void put(long id, int64_t timestamp, std::string_view role, std::string_view content,
+             const std::vector<std::string_view> &tags = {});
+    // Throws std::invalid_argument, as put() does, if a tag is empty or contains '\0'
+    static void checkTags(const std::vector<std::string_view> &tags);
+    // Distinct roles interned so far
+    size_t roleCount() const { return role_count_.load(std::memory_order_acquire); }
+    // Appends every record of a metadata file, copying its heap in one piece.
+    // Throws std::runtime_error, leaving the store unchanged, if any record's id,
+    // role, content or tags are out of range.
+    void load(const MetadataStore &store);
+    void clear();
+
+    bool contains(long id) const
+    {
+        return id >= 0 && (size_t)id < roles_.size() && roles_[id] != NO_ENTRY;
+    }
+    int64_t timestamp(long id) const { return timestamps_[id]; }
+    uint8_t roleCode(long id) const { return roles_[id]; }
+    std::string_view role(long id) const { return roleName(roles_[id]); }
+    std::string_view roleName(uint8_t code) const { return role_names_[code]; }
+    // NO_ENTRY if no entry has ever had this role
+    uint8_t findRole(std::string_view role) const;
+    std::string_view content(long id) const { return {contentData(id), content_lengths_[id]}; }
+    const char *contentData(long id) const;
+    // The entry's tags, '\0'-separated
+    std::string_view packedTags(long id) const
+    {
+        return tag_lengths_[id] ? std::string_view(arenaData(tag_offsets_[id]), tag_lengths_[id]) : std::string_view();
+    }
+    std::vector<std::string_view> tags(long id) const { return unpackTags(packedTags(id)); }
+    static std::vector<std::string_view> unpackTags(std::string_view packed);
+    const TagIndex &tagIndex() const { return tag_index_; }
+    // Ids of the entries with role code, or nullptr once an id too large for a
+    // bitmap has been stored; may still hold ids whose role has since changed
+    const TagBitmap *roleIds(uint8_t code) const
+    {
+        return role_ids_complete_ && code < MAX_ROLES ? &role_ids_[code] : nullptr;
+    }
+    // Compact JSON object for the entry, as written by appendEntryJson()
+    std::string_view json(long id) const { return {arenaData(json_offsets_[id]), json_lengths_[id]}; }
+
+    // First id whose timestamp is at least t, or endId() if there is none. Only a
+    // hint (0) unless timestampsSorted(), so callers still check each timestamp.
+    long lowerBoundTime(int64_t t) const;
+    // True while timestamps never decrease as ids increase
+    bool timestampsSorted() const { return timestamps_sorted_; }
+
+    // Number of entries present
+    size_t size() const { return count_; }
+    // One past the largest id ever stored
+    long endId() const { return roles_.size(); }
+    size_t memoryUsage() const;
+
+private:
+    void validate(const MetadataStore &store) const;
+    uint8_t internRole(std::string_view role);
+    uint64_t appendBytes(std::string_view bytes);
+    const char *arenaData(uint64_t offset) const;
+    void putJson(long id, const std::vector<std::string_view> &tags);
+    void putTags(long id, const std::vector<std::string_view> &tags);
+    void putTimestamp(long id, int64_t timestamp);
+    void putRole(long id, uint8_t code);
+    size_t roleIdsUsage() const;
+    void grow(long id);
+
+    static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+    std::vector<int64_t> timestamps_;
+    std::vector<uint8_t> roles_;
+    // chunk index in the high 32 bits, offset within the chunk in the low 32 bits
+    std::vector<uint64_t> content_offsets_;
+    std::vector<uint32_t> content_lengths_;
+    std::vector<uint64_t> json_offsets_;
+    std::vector<uint32_t> json_lengths_;
+    std::vector<uint64_t> tag_offsets_;
+    std::vector<uint32_t> tag_lengths_;
+    TagIndex tag_index_;
+    std::array<TagBitmap, MAX_ROLES> role_ids_;
+    bool role_ids_complete_ = true; // false once an id above UINT32_MAX was stored
+    std::string json_scratch_;
+    std::string tag_scratch_;
+    size_t count_ = 0;
+    bool timestamps_sorted_ = true;
+
+    // Role names are written once and never moved, so readers may look them up without locks
+    std::array<std::string, MAX_ROLES> role_names_;
+    std::atomic<size_t> role_count_{0};
+
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    size_t current_chunk_ = 0; // chunk small contents are appended to
+    size_t chunk_used_ = CHUNK_SIZE; // bytes used in current_chunk_
+    size_t arena_bytes_ = 0;
+};
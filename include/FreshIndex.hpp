@@ -0,0 +1,47 @@
+#pragma once
+
+#include "hnswlib/hnswlib.h"
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// The newest vectors, kept in a flat buffer that is scanned exactly with the
+// graph's SIMD inner-product distance. A vector lands here first and is copied
+// into the HNSW graph later, in batches, by a background thread; it stays in the
+// buffer after that until newer vectors push it out, so the newest entries are
+// always searched exactly. Only vectors already in the graph are pushed out.
+// Not thread-safe: MemoryManager's mutex guards it.
+class FreshIndex
+{
+public:
+    FreshIndex(size_t dimension, size_t capacity);
+
+    bool enabled() const { return capacity_ > 0; }
+    // False if the buffer is full of vectors not yet in the graph
+    bool add(const float *vector, long id);
+    // nullptr if id is not in the buffer
+    const float *find(long id) const;
+
+    // Ids not yet in the graph, oldest first
+    size_t pendingCount() const { return ids_.size() - indexed_; }
+    long pendingId(size_t i) const { return ids_[indexed_ + i]; }
+    // The n oldest pending vectors have been added to the graph
+    void markIndexed(size_t n) { indexed_ += n; }
+
+    // Nearest k (distance, id) pairs, nearest first
+    std::vector<std::pair<float, hnswlib::labeltype>> search(const float *query, size_t k,
+                                                             hnswlib::BaseFilterFunctor *filter = nullptr) const;
+
+    void clear();
+    size_t size() const { return ids_.size(); }
+    size_t memoryUsage() const;
+
+private:
+    size_t capacity_;
+    hnswlib::InnerProductSpace space_; // the graph's distance, normalized vectors
+    std::unique_ptr<hnswlib::BruteforceSearch<float>> vectors_;
+    std::deque<long> ids_; // oldest first
+    size_t indexed_ = 0;   // ids_[0, indexed_) are in the graph too
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ISO-8601 UTC ("2024-01-31T12:00:00Z") <-> epoch seconds
+std::string formatTimestamp(int64_t epoch);
+int64_t parseTimestamp(const std::string &ts);
+
+// Appends s as a quoted JSON string, escaping like nlohmann::json::dump(). Invalid
+// UTF-8 is replaced with U+FFFD, as dump() does with error_handler_t::replace.
+void appendJsonString(std::string &out, std::string_view s);
+
+// Appends the compact JSON object for one memory entry. Keys are in the order
+// nlohmann::json uses for objects, so output matches json(MemoryEntry).dump().
+// "tags" is only written when there are any.
+void appendEntryJson(std::string &out, long id, int64_t timestamp, std::string_view role,
+                     std::string_view content, const std::vector<std::string_view> &tags = {});
+
+// Joins pre-serialized objects into a JSON array in one allocation. Pretty
+// output re-indents the result and is only meant for explicit requests.
+std::string joinJsonArray(const std::vector<std::string_view> &fragments, bool pretty = false);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "MemoryManager.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Binary request format shared by the local transports (Unix socket and shared
+// memory). A request starts with an opcode byte; integers are little-endian
+// uint32 and strings run to the end of the request unless a length is given.
+//
+//   ADD       1  role_length, role, content
+//   RECENT    2  n (0xFFFFFFFF: the whole short-term window)
+//   SEMANTIC  3  k, query
+//   VECTOR    4  k, float32[dimension]
+//   EMBED     5  type byte (0 query, 1 document), text
+//
+// The response is a status and a body: a compact JSON array for RECENT,
+// SEMANTIC and VECTOR, raw float32 for EMBED, nothing for ADD, and a message
+// for errors.
+enum LocalOp : uint8_t
+{
+    OP_ADD = 1,
+    OP_RECENT = 2,
+    OP_SEMANTIC = 3,
+    OP_VECTOR = 4,
+    OP_EMBED = 5
+};
+
+enum LocalStatus : uint8_t
+{
+    STATUS_OK = 0,
+    STATUS_BAD_REQUEST = 1,
+    STATUS_STARTING_UP = 2,
+    STATUS_ERROR = 3
+};
+
+// Never throws; failures are reported through the status and body.
+LocalStatus handleLocalRequest(MemoryManager &memory, std::string_view request, std::string &body);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "LocalProtocol.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Unix domain socket listener for clients on the same host. It skips TCP and
+// HTTP framing and serves the same MemoryManager as the HTTP routes. Access is
+// controlled by the socket file's permissions (0660) instead of X-Auth.
+//
+// Every message is a frame: a little-endian uint32 length followed by that many
+// bytes. A request frame holds one request as described in LocalProtocol.hpp;
+// a response frame holds the status byte followed by the body.
+class LocalServer
+{
+public:
+    static constexpr uint32_t MAX_FRAME_SIZE = 64u << 20;
+
+    LocalServer(MemoryManager &memory, const std::string &socket_path);
+    ~LocalServer();
+
+    LocalServer(const LocalServer &) = delete;
+    LocalServer &operator=(const LocalServer &) = delete;
+
+    // Binds the socket and starts accepting. Throws std::runtime_error.
+    void start();
+    void stop();
+
+private:
+    void acceptLoop();
+    void serve(int fd);
+
+    MemoryManager &memory_;
+    std::string socket_path_;
+    int listen_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+    std::thread accept_thread_;
+
+    // Connection threads are detached; stop() shuts their sockets down and
+    // waits until every one has removed itself from client_fds_
+    std::mutex clients_mtx_;
+    std::condition_variable clients_cv_;
+    std::vector<int> client_fds_;
+};
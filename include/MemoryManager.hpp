@@ -1,16 +1,27 @@
 #pragma once
 
 #include "llama.hpp"
-#include "crow.h"
+#include "Persistence.hpp"
+#include "EntryStore.hpp"
+#include "ShortTermRing.hpp"
+#include "JsonWriter.hpp"
+#include "SingleFlight.hpp"
+#include "SearchCache.hpp"
+#include "FreshIndex.hpp"
+#include "ShardedIndex.hpp"
 #include <nlohmann/json.hpp>
 #include <vector>
 #include <string>
 #include <mutex>
-#include <deque>
 #include <unordered_map>
 #include <fstream>
 #include <atomic>
 #include <thread>
+#include <condition_variable>
+#include <future>
+#include <limits>
+#include <memory>
+#include <functional>
 
 // Remove FAISS includes
 // #include <faiss/IndexFlat.h>
@@ -24,11 +35,119 @@ using json = nlohmann::json;
 struct MemoryEntry
 {
     long id;
-    std::string timestamp;
+    int64_t timestamp; // seconds since the Unix epoch, UTC
     std::string role;
     std::string content;
+    std::vector<std::string> tags;
 };
 
+// One entry for MemoryManager::addBatch()
+struct MemoryInput
+{
+    std::string role;
+    std::string content;
+    std::vector<std::string> tags;
+};
+
+// Zero-copy view of an entry. The strings point into the store and stay valid
+// until the MemoryManager is destroyed.
+struct MemoryView
+{
+    long id;
+    int64_t timestamp;
+    std::string_view role;
+    std::string_view content;
+    std::string_view json; // compact JSON object, as in the HTTP responses
+    std::string_view tags; // '\0'-separated; see EntryStore::unpackTags()
+};
+
+struct MemoryConfig
+{
+    // Directory holding MANIFEST and the generation files it names
+    std::string data_dir = ".";
+    int dimension = 768;
+    size_t max_elements = 20000;
+    // HNSW shards searched in parallel, each holding max_elements / index_shards
+    // vectors. Fixed when a store is first saved; an existing store keeps its count.
+    size_t index_shards = 1;
+    // Map memory_index.hnsw instead of reading it into malloc'd buffers
+    bool mmap_index = true;
+    // Also check the index file CRC on startup (O(index size))
+    bool verify_checksums = false;
+    // Checkpoints write deltas; this many deltas are folded into a new base generation
+    size_t merge_after_deltas = 16;
+    // Entries kept for GET /memory/retrieve/recent, overall and per session
+    size_t short_term_capacity = 50;
+    // Newest vectors searched exactly and added to the graph in the background; 0 adds
+    // each vector to the graph as it arrives
+    size_t fresh_capacity = 1024;
+    // Sessions with their own recent window; 0 disables sessions
+    size_t max_sessions = 10000;
+    // Sessions without an add for this long are dropped
+    int64_t session_idle_seconds = 3600;
+    // Semantic search results cached across requests; 0 disables the cache
+    size_t result_cache_size = 1024;
+    // Recent query embeddings checked for a near-identical earlier query; 0 disables
+    size_t query_cache_size = 256;
+    // Cosine distance within which an earlier query's result is reused; 0 disables
+    float query_cache_epsilon = 0.0f;
+};
+
+// Restricts a search to entries matching every given field. Applied during the
+// graph walk, or by scoring the matches directly when only a few entries match.
+struct SearchFilter
+{
+    std::string role; // empty matches any role
+    std::vector<std::string> tags;     // entries must carry all of these
+    std::vector<std::string> any_tags; // and at least one of these, if any are given
+    int64_t since = std::numeric_limits<int64_t>::min(); // timestamps, inclusive
+    int64_t until = std::numeric_limits<int64_t>::max();
+    long min_id = 0; // ids, inclusive
+    long max_id = std::numeric_limits<long>::max();
+
+    bool empty() const
+    {
+        return role.empty() && tags.empty() && any_tags.empty() && since == std::numeric_limits<int64_t>::min() &&
+               until == std::numeric_limits<int64_t>::max() && min_id <= 0 &&
+               max_id == std::numeric_limits<long>::max();
+    }
+};
+
+// Per-query search parameters. Part of the result cache key.
+struct SearchOptions
+{
+    // HNSW search breadth; 0 uses the index default
+    size_t ef = 0;
+    // Range search: instead of the k nearest entries, every entry within max_distance
+    // (cosine distance), nearest first and at most max_results. The graph walk stops
+    // once candidates leave the radius. The nearest min_results entries are returned
+    // even if they lie outside it.
+    bool range = false;
+    float max_distance = 0.75f;
+    size_t min_results = 0;
+    size_t max_results = 100;
+    SearchFilter filter;
+};
+
+// Entries with from <= timestamp <= to, oldest first, limit at a time. A page
+// resumes at cursor, the id returned as the previous page's next_cursor.
+struct TimeRange
+{
+    int64_t from = std::numeric_limits<int64_t>::min();
+    int64_t to = std::numeric_limits<int64_t>::max();
+    long cursor = 0;
+    size_t limit = 100;
+};
+
+struct MemoryPage
+{
+    std::vector<MemoryView> views;
+    long next_cursor = -1; // -1 once the range is exhausted
+};
+
+// An embedding model loaded once and shared by several stores; nullptr if it failed to load
+using SharedModel = std::shared_future<std::shared_ptr<LlamaEmbeddingGenerator>>;
+
 enum class TaskType
 {
     Query,
@@ -41,41 +160,212 @@ void from_json(const json &j, MemoryEntry &m);
 class MemoryManager
 {
 public:
-    MemoryManager(const std::string &model_path, int dimension = 768);
+    MemoryManager(const std::string &model_path, const MemoryConfig &config = MemoryConfig());
+    // Uses model instead of loading its own, waiting for it if it is still loading
+    MemoryManager(SharedModel model, const MemoryConfig &config = MemoryConfig());
     ~MemoryManager();
 
-    void add(const std::string &role, const std::string &content);
-    std::vector<MemoryEntry> getRelevantMemories(const std::string &query, int k);
-    std::vector<MemoryEntry> getLastN(int n);
-    size_t getShortTermSize() const;
+    // A non-empty session also records the entry in that session's recent window
+    void add(const std::string &role, const std::string &content, const std::vector<std::string> &tags = {},
+             const std::string &session = "");
+    // Adds the inputs as consecutive entries. Their contents are embedded in one
+    // call before mtx_ is taken, and all of them are stored under one hold of it.
+    // All or nothing: throws, storing none, if a role or tag is invalid or the
+    // embedding fails.
+    void addBatch(const std::vector<MemoryInput> &inputs, const std::string &session = "");
+    std::vector<MemoryEntry> getRelevantMemories(const std::string &query, int k, const SearchOptions &options = {});
+    // The newest entries overall, or within a session if one is given
+    std::vector<MemoryEntry> getLastN(int n, const std::string &session = "");
+    // Same results without copying any strings
+    std::vector<MemoryView> getRelevantMemoryViews(const std::string &query, int k, const SearchOptions &options = {});
+    std::vector<MemoryView> getRelevantMemoryViewsByVector(std::vector<float> query_vector, int k,
+                                                           const SearchOptions &options = {});
+    std::vector<MemoryView> getLastNViews(int n, const std::string &session = "");
+    // Same results as a JSON array, assembled from each entry's cached serialization
+    std::string getRelevantMemoriesJson(const std::string &query, int k, bool pretty = false,
+                                        const SearchOptions &options = {});
+    std::string getLastNJson(int n, bool pretty = false, const std::string &session = "");
+    // Entries by time, found by binary search on the timestamp column
+    std::vector<MemoryEntry> getRange(const TimeRange &range, long &next_cursor);
+    MemoryPage getRangeViews(const TimeRange &range);
+    // {"memories":[...],"next_cursor":id or null}
+    std::string getRangeJson(const TimeRange &range, bool pretty = false);
+    // Several text queries answered together, one result list per query in order.
+    // The queries are embedded in one multi-sequence encode and searched in parallel.
+    std::vector<std::vector<MemoryEntry>> getRelevantMemoriesBatch(const std::vector<std::string> &queries, int k,
+                                                                   const SearchOptions &options = {});
+    std::vector<std::vector<MemoryView>> getRelevantMemoryViewsBatch(const std::vector<std::string> &queries, int k,
+                                                                     const SearchOptions &options = {});
+    // A JSON array holding each query's array of results
+    std::string getRelevantMemoriesBatchJson(const std::vector<std::string> &queries, int k, bool pretty = false,
+                                             const SearchOptions &options = {});
+    // Search with a caller-supplied embedding of getDimension() floats
+    std::vector<MemoryEntry> getRelevantMemoriesByVector(std::vector<float> query_vector, int k,
+                                                         const SearchOptions &options = {});
+    std::string getRelevantMemoriesByVectorJson(std::vector<float> query_vector, int k, bool pretty = false,
+                                                const SearchOptions &options = {});
+    // Normalized embedding of text, as used for the index
+    std::vector<float> embed(const std::string &text, TaskType type);
+    int getDimension() const;
+    // Approximate bytes held for the entries and the index
+    size_t memoryUsage();
+    // memoryUsage() as last measured (after loading and at each checkpoint) plus an
+    // estimate for every add since. Lock-free; 0 until the store has loaded.
+    size_t usageEstimate() const { return usage_.load(std::memory_order_relaxed); }
+    size_t getShortTermSize(const std::string &session = "") const;
+
+    // Startup runs in the background: recent reads are possible once metadata is
+    // loaded, adds and semantic search once the model and index are loaded too
+    bool isMetadataReady() const;
+    bool isSearchReady() const;
 
 private:
+    // A text query on its way through the result caches and the graph
+    struct QuerySearch
+    {
+        std::string key; // query, '\0', searchParams()
+        std::string params;
+        std::shared_ptr<const CachedSearch> cached;
+        std::shared_ptr<const std::vector<float>> embedding; // normalized; nullptr if embedding failed
+        SimilarQueryCache::Match similar;
+        std::vector<SearchHit> hits;
+    };
+
+    struct StartupTimings
+    {
+        long model_ms = 0;
+        long index_ms = 0;
+        long metadata_ms = 0;
+        long metadata_ready_ms = 0;
+        long search_ready_ms = 0;
+    };
+
+    std::thread startup_thread_;
+    std::mutex ready_mtx_;
+    std::condition_variable ready_cv_;
+    std::atomic<bool> metadata_ready_{false};
+    std::atomic<bool> search_ready_{false};
+    bool index_loaded_ = false; // the index on disk is in, though the model may not be
+    bool startup_done_ = false;
+    std::atomic<bool> startup_failed_{false};
+    StartupTimings timings_;
+
     std::atomic<bool> dirty_{false};
+    std::atomic<size_t> usage_{0};
     std::atomic<bool> stop_saving_{false};
+    std::mutex stop_mtx_;
+    std::condition_variable stop_cv_;
     std::thread saver_thread_;
+    // Moves vectors from fresh_ into the graph; waits on indexer_cv_ with mtx_
+    std::thread indexer_thread_;
+    std::condition_variable indexer_cv_;
+    // Under mtx_: a batch is being inserted into the graph with mtx_ released.
+    // Saving the graph waits on indexed_cv_ until it is published.
+    bool indexing_ = false;
+    std::condition_variable indexed_cv_;
 
     std::string model_path_;
+    MemoryConfig config_;
     int dimension_ = 768;
     long next_id_ = 0;
-    std::unique_ptr<LlamaEmbeddingGenerator> embedding_generator_;
+    SharedModel shared_model_; // not valid() if the store loads model_path_ itself
+    std::shared_ptr<LlamaEmbeddingGenerator> embedding_generator_;
 
     // Replace FAISS pointer with hnswlib index and space pointers
-    hnswlib::HierarchicalNSW<float> *index_ = nullptr;
     hnswlib::SpaceInterface<float> *space_ = nullptr;
+    ShardedIndex index_;
 
-    std::unordered_map<long, MemoryEntry> memory_data_;
-    std::deque<long> short_term_ids_;
+    FreshIndex fresh_;
+    EntryStore entries_;
+    // Read without mtx_; written only by add()
+    ShortTermRing short_term_;
+    SessionRings sessions_;
+    // In-flight text searches keyed on (query, k)
+    SingleFlight<std::vector<MemoryView>> search_flights_;
+    // Ranked hits per (query, k, ef), validated against entries added since
+    SearchCache result_cache_;
+    // Same results reached through a differently worded query with a nearby embedding
+    SimilarQueryCache similar_queries_;
+    static constexpr float SEARCH_THRESHOLD = 0.75f; // maximum cosine distance of a result
+    static constexpr long MAX_CACHE_REVALIDATION = 256; // more new entries than this: search again
+    static constexpr size_t MAX_EXACT_SCAN = 4096; // filters matching at most this many entries skip the graph
+    static constexpr size_t MAX_FILTERED_EF = 1024; // widest beam a selective filter widens ef to
+    // Graph parameters of every new index; a loaded index keeps those it was built with
+    static constexpr size_t HNSW_M = 32;
+    static constexpr size_t HNSW_EF_CONSTRUCTION = 400;
+    static constexpr size_t INDEX_BATCH = 64; // fresh vectors the indexer thread adds to the graph at a time
     std::mutex mtx_;
 
     // Increased max_elements capacity for index - you can tune this in the .cpp constructor
     size_t max_elements_;
 
-    // Paths updated to reflect hnswlib usage
-    const std::string text_file_path = "memory_data.json";
-    const std::string hnsw_index_path = "memory_index.hnsw";
+    // MANIFEST names the current and previous generation of memory_index.<gen>.hnsw
+    // and memory_data.<gen>.bin; saves write a new generation and swap the manifest
+    Manifest manifest_;
+    bool has_manifest_ = false;
+    uint64_t last_generation_ = 0;
+    // Ids from here on are not yet in any checkpoint
+    long checkpoint_next_id_ = 0;
+    // Set when a delta could not be written; the next checkpoint writes a full generation
+    bool force_full_save_ = false;
+
+    // Pre-manifest file names, read only when no MANIFEST exists
+    const std::string legacy_metadata_file = "memory_data.bin";
+    const std::string legacy_text_file = "memory_data.json"; // migrated on startup
+    const std::string legacy_index_file = "memory_index.hnsw";
+
+    MemoryManager(const std::string &model_path, SharedModel model, const MemoryConfig &config);
 
-    std::string currentTimestamp() const;
-    std::vector<float> MemoryManager::generateEmbedding(const std::string &text, TaskType type) const;
-    void saveToDisk();
-    void loadFromDisk();
+    int64_t currentTimestamp() const;
+    MemoryEntry entryAt(long id) const;
+    MemoryView viewAt(long id) const;
+    // The stored vector for id, from the graph or fresh_; nullptr if it was never embedded
+    const float *vectorOf(long id) const;
+    // Caller holds lock on mtx_, which is released while the vectors are inserted
+    void indexPending(std::unique_lock<std::mutex> &lock, size_t max);
+    std::vector<RecentEntry> recentEntries(int n, const std::string &session) const;
+    std::vector<MemoryView> searchText(const std::string &key, const std::string &query, int k,
+                                       const SearchOptions &options);
+    static std::string searchParams(int k, const SearchOptions &options);
+    void findCached(QuerySearch &search);
+    void findSimilar(QuerySearch &search, std::vector<float> embedding);
+    // Caller holds mtx_. Takes the hits from search.cached if from_cache, and caches search.hits otherwise.
+    void finishSearch(QuerySearch &search, bool from_cache);
+    bool cachedSearchHolds(const CachedSearch &cached, int k, const SearchOptions &options) const;
+    std::vector<SearchHit> searchVector(std::vector<float> &query_vector, int k, const SearchOptions &options,
+                                        const std::string &label);
+    std::vector<float> generateEmbedding(const std::string &text, TaskType type) const;
+    std::vector<std::vector<float>> generateEmbeddings(const std::vector<std::string> &texts, TaskType type) const;
+    std::string dataPath(const std::string &name) const;
+    void startup();
+    void waitForMetadata();
+    void waitForIndex();
+    void waitForSearch();
+    // Caller holds lock on mtx_; it is released while pending vectors go into the graph
+    bool checkpoint(std::unique_lock<std::mutex> &lock);
+    bool saveToDisk();
+    bool saveDelta();
+    void mergeDeltas();
+    std::vector<std::string> generationFiles(const Generation &generation) const;
+    void removeGenerationFiles(const Generation &generation);
+    void setAsideGenerationFiles(const Generation &damaged, const Generation &loaded);
+    void loadFromDisk(const std::function<void()> &metadata_loaded);
+    bool loadGeneration(const Generation &generation, std::unique_lock<std::mutex> &lock,
+                        const std::function<void()> &metadata_loaded);
+    void loadGenerationIndex(const Generation &generation);
+    void loadGenerationMetadata(const Generation &generation);
+    void loadIndex(size_t shard, const std::string &path);
+    size_t loadMetadata(const std::string &path);
+    void migrateJsonMetadata();
+    void resetState();
+    // Caller holds mtx_. Stores the entry under the next id and returns the id;
+    // throws std::invalid_argument or std::runtime_error before storing anything.
+    long putEntry(const std::string &role, const std::string &content, const std::vector<std::string> &tags,
+                  const std::string &session);
+    // Caller holds mtx_. Normalizes embedding and queues it for the index.
+    void putVector(long id, std::vector<float> &embedding);
+    // Throws as putEntry() would for any of the inputs
+    void checkInputs(const std::vector<MemoryInput> &inputs) const;
+    // Caller holds mtx_. Measures memoryUsage() into usage_.
+    size_t refreshUsage();
 };
\ No newline at end of file
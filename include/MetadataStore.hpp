@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// On-disk layout of memory_data.bin:
+//
+//   MetadataHeader
+//   MetadataRoleSlot[role_count]   role strings, indexed by MetadataRecord::role
+//   MetadataRoleSlot[tag_count]    tag strings, indexed by the tag links
+//   MetadataRecord[record_count]   fixed-width, sorted by id
+//   MetadataTagRange[record_count] each record's run of tag links; absent if tag_count is 0
+//   uint32_t[tag_link_count]       tag links
+//   heap[heap_size]                role, tag and content bytes
+//
+// All integers are little-endian. Every section carries a CRC32 in the header,
+// and the header carries its own CRC32 (computed over header_size bytes with
+// header_crc zeroed). Version 1 files have a 56-byte header and no tag sections;
+// they are still read.
+
+constexpr char METADATA_MAGIC[8] = {'J', 'M', 'E', 'M', 'D', 'A', 'T', 'A'};
+constexpr uint32_t METADATA_VERSION = 2;
+constexpr uint32_t METADATA_V1_HEADER_SIZE = 56;
+
+struct MetadataHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t record_count;
+    uint32_t role_count;
+    uint32_t tag_count; // zero in version 1
+    uint64_t heap_size;
+    uint32_t roles_crc;
+    uint32_t records_crc;
+    uint32_t heap_crc;
+    uint32_t header_crc;
+    // Version 2
+    uint64_t tag_link_count;
+    uint32_t tags_crc; // tag slots, tag ranges and tag links
+    uint32_t reserved;
+};
+
+struct MetadataRoleSlot
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+};
+
+struct MetadataTagRange
+{
+    uint32_t first; // index of the record's first tag link
+    uint32_t count;
+};
+
+struct MetadataRecord
+{
+    int64_t id;
+    int64_t timestamp; // seconds since the Unix epoch, UTC
+    uint32_t role;
+    uint32_t content_length;
+    uint64_t content_offset;
+};
+
+static_assert(sizeof(MetadataHeader) == 72, "MetadataHeader layout changed");
+static_assert(sizeof(MetadataTagRange) == 8, "MetadataTagRange layout changed");
+static_assert(sizeof(MetadataRoleSlot) == 16, "MetadataRoleSlot layout changed");
+static_assert(sizeof(MetadataRecord) == 32, "MetadataRecord layout changed");
+
+uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+// Read-only view over a memory-mapped metadata file. Opening only maps the file
+// and validates the header, so it is O(1) regardless of the number of records.
+class MetadataStore
+{
+public:
+    MetadataStore() = default;
+    ~MetadataStore();
+
+    MetadataStore(const MetadataStore &) = delete;
+    MetadataStore &operator=(const MetadataStore &) = delete;
+
+    // Throws std::runtime_error if the file is missing, truncated or has a bad header.
+    void open(const std::string &path);
+    void close();
+
+    // Checks the section checksums, that every offset lies in the heap and every
+    // code in its table, and that record ids are non-negative and increasing.
+    // O(file size).
+    bool verify() const;
+    // Whether [offset, offset + length) lies within the heap
+    bool inHeap(uint64_t offset, uint64_t length) const;
+
+    size_t size() const { return base_ ? header_.record_count : 0; }
+    size_t roleCount() const { return base_ ? header_.role_count : 0; }
+    size_t tagCount() const { return base_ ? header_.tag_count : 0; }
+    const MetadataRecord &record(size_t i) const { return records_[i]; }
+    const char *heap() const { return heap_; }
+    size_t heapSize() const { return base_ ? header_.heap_size : 0; }
+    // Empty for a code out of range or a string outside the heap
+    std::string_view role(uint32_t code) const;
+    std::string_view tag(uint32_t code) const;
+    bool roleValid(uint32_t code) const { return code < roleCount() && inHeap(roles_[code].offset, roles_[code].length); }
+    bool tagValid(uint32_t code) const { return code < tagCount() && inHeap(tags_[code].offset, tags_[code].length); }
+    std::string_view content(const MetadataRecord &r) const;
+    // Tag codes of record i
+    std::vector<uint32_t> tagCodes(size_t i) const;
+    // Record i's tag codes in place, without copying; {nullptr, 0} if its range is out of bounds
+    std::pair<const uint32_t *, uint32_t> tagLinks(size_t i) const;
+
+private:
+    void *base_ = nullptr;
+    size_t mapped_size_ = 0;
+    MetadataHeader header_{}; // copied, since a version 1 header is shorter
+    const MetadataRoleSlot *roles_ = nullptr;
+    const MetadataRoleSlot *tags_ = nullptr;
+    const MetadataRecord *records_ = nullptr;
+    const MetadataTagRange *tag_ranges_ = nullptr;
+    const uint32_t *tag_links_ = nullptr;
+    const char *heap_ = nullptr;
+};
+
+// Accumulates records in memory and writes them out in the layout above.
+class MetadataWriter
+{
+public:
+    void add(int64_t id, int64_t timestamp, std::string_view role, std::string_view content,
+             const std::vector<std::string_view> &tags = {});
+
+    // Throws std::runtime_error on I/O failure.
+    void write(const std::string &path);
+
+private:
+    uint32_t internRole(std::string_view role);
+    uint32_t internTag(std::string_view tag);
+
+    std::vector<MetadataRoleSlot> roles_;
+    std::vector<MetadataRoleSlot> tags_;
+    std::unordered_map<std::string, uint32_t> tag_codes_;
+    std::vector<MetadataRecord> records_;
+    std::vector<MetadataTagRange> tag_ranges_; // parallel to records_ until write() sorts them
+    std::vector<uint32_t> tag_links_;
+    std::string heap_;
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// One shard's file of a sharded index, described like the unsharded index file
+struct IndexShardFile
+{
+    std::string file;
+    uint64_t size = 0;
+    uint32_t crc = 0;   // unused for deltas
+    uint64_t count = 0; // elements in the shard
+};
+
+// Changes written since the generation's base files: the index elements that
+// were modified and the metadata records that were added.
+struct DeltaCheckpoint
+{
+    std::string index_file;
+    uint64_t index_size = 0;
+    uint64_t index_count = 0;  // elements in the index once this delta is applied
+    std::string metadata_file;
+    uint64_t metadata_size = 0;
+    uint64_t record_count = 0; // records in this delta file
+    std::vector<IndexShardFile> shard_files; // deltas of shards 1 and up; the index_ fields are shard 0
+
+    size_t shardCount() const { return 1 + shard_files.size(); }
+    IndexShardFile indexShard(size_t i) const
+    {
+        return i == 0 ? IndexShardFile{index_file, index_size, 0, index_count} : shard_files[i - 1];
+    }
+    void setIndexShard(size_t i, const IndexShardFile &shard)
+    {
+        if (i > 0)
+        {
+            shard_files.resize(std::max(shard_files.size(), i));
+            shard_files[i - 1] = shard;
+            return;
+        }
+        index_file = shard.file;
+        index_size = shard.size;
+        index_count = shard.count;
+    }
+};
+
+// One consistent snapshot of the store: an index file and a metadata file
+// written together and named by the same generation number.
+struct Generation
+{
+    uint64_t generation = 0;
+    std::string index_file;    // relative to the data directory
+    uint64_t index_size = 0;
+    uint32_t index_crc = 0;
+    uint64_t index_count = 0;  // elements in the index
+    std::string metadata_file; // relative to the data directory
+    uint64_t metadata_size = 0;
+    uint64_t record_count = 0; // records in the metadata file
+    std::vector<DeltaCheckpoint> deltas; // applied in order on top of the base files
+    std::vector<IndexShardFile> shard_files; // shards 1 and up of a sharded index; the index_ fields are shard 0
+
+    size_t shardCount() const { return 1 + shard_files.size(); }
+    IndexShardFile indexShard(size_t i) const
+    {
+        return i == 0 ? IndexShardFile{index_file, index_size, index_crc, index_count} : shard_files[i - 1];
+    }
+    void setIndexShard(size_t i, const IndexShardFile &shard)
+    {
+        if (i > 0)
+        {
+            shard_files.resize(std::max(shard_files.size(), i));
+            shard_files[i - 1] = shard;
+            return;
+        }
+        index_file = shard.file;
+        index_size = shard.size;
+        index_crc = shard.crc;
+        index_count = shard.count;
+    }
+};
+
+// MANIFEST names the current generation and the one before it. It is only ever
+// replaced atomically, so it always points at a fully written pair of files.
+struct Manifest
+{
+    Generation current;
+    std::optional<Generation> previous;
+};
+
+// Returns false if the manifest does not exist; throws std::runtime_error if it is unreadable.
+bool readManifest(const std::string &path, Manifest &manifest);
+void writeManifest(const std::string &path, const Manifest &manifest);
+
+// Flushes a file (or a directory entry table) to stable storage. Throws std::runtime_error.
+void fsyncPath(const std::string &path, bool directory = false);
+
+// fsyncs tmp_path, renames it over final_path and fsyncs the containing directory.
+void commitFile(const std::string &tmp_path, const std::string &final_path);
+
+uint32_t fileCrc32(const std::string &path);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr size_t MAX_TAGS = 64;
+constexpr size_t MAX_TAG_LENGTH = 256;
+constexpr size_t MAX_SESSION_LENGTH = 256;
+
+// Body of POST /memory/add
+struct AddRequest
+{
+    std::string role;
+    std::string content;
+    std::vector<std::string> tags; // optional
+    std::string session;           // optional
+};
+
+// Parses the body with a SAX handler that keeps only the top-level "role",
+// "content" and "session" strings and the "tags" array; the parser's string
+// buffers are moved into the fields, so no JSON DOM is built and each string is
+// allocated once. Throws std::invalid_argument if the body is not valid JSON;
+// returns false if it is not an object with string "role" and "content" members,
+// if "tags" is present but not an array of valid tags, or if "session" is present
+// but not a valid session id.
+bool parseAddRequest(std::string_view body, AddRequest &request);
+
+// At most MAX_TAGS tags of 1 to MAX_TAG_LENGTH bytes, without ',' (the separator
+// in query parameters) or NUL
+bool validTags(const std::vector<std::string> &tags);
+
+// 1 to MAX_SESSION_LENGTH bytes
+bool validSession(const std::string &session);
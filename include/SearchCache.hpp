@@ -0,0 +1,104 @@
+#pragma once
+
+#include "hnswlib/hnswlib.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SearchHit
+{
+    long id;
+    float distance;
+};
+
+// A finished search: the normalized query embedding and the ranked hits, valid
+// for the entries that existed when it ran (ids below end_id).
+struct CachedSearch
+{
+    uint64_t end_id = 0;
+    std::shared_ptr<const std::vector<float>> embedding;
+    std::vector<SearchHit> hits;
+};
+
+// Bounded LRU of search results keyed on the query and its parameters. Entries
+// carry the store generation they were computed at; deciding whether an older
+// entry still holds is left to the caller, which knows what changed since.
+class SearchCache
+{
+public:
+    explicit SearchCache(size_t capacity) : capacity_(capacity) {}
+
+    // nullptr on a miss
+    std::shared_ptr<const CachedSearch> get(const std::string &key);
+    void put(const std::string &key, std::shared_ptr<const CachedSearch> value);
+    void clear();
+
+    size_t capacity() const { return capacity_; }
+    // Read without the lock, for stats
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const CachedSearch>>;
+
+    size_t capacity_;
+    std::mutex mtx_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
+
+// Embeddings of recently searched queries in a small flat index, so a query
+// worded differently from one already answered but landing within epsilon
+// (cosine distance) of it reuses that result instead of searching the store.
+// Only searches run with the same parameters match. Slots are reused oldest
+// first.
+class SimilarQueryCache
+{
+public:
+    static constexpr size_t NO_SLOT = SIZE_MAX;
+
+    struct Match
+    {
+        size_t slot = NO_SLOT;
+        std::shared_ptr<const CachedSearch> value; // nullptr if nothing was within epsilon
+    };
+
+    SimilarQueryCache(size_t dimension, size_t capacity, float epsilon);
+
+    // embedding must be normalized
+    Match find(const std::vector<float> &embedding, const std::string &params);
+    // Stores value under its own embedding, replacing slot if one is given
+    void put(const std::string &params, std::shared_ptr<const CachedSearch> value, size_t slot = NO_SLOT);
+    void clear();
+
+    bool enabled() const { return capacity_ > 0 && epsilon_ > 0.0f; }
+    // Read without the lock, for stats
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot
+    {
+        std::string params;
+        std::shared_ptr<const CachedSearch> value;
+    };
+    class ParamsFilter;
+
+    size_t capacity_;
+    float epsilon_;
+    hnswlib::InnerProductSpace space_;
+    std::mutex mtx_;
+    std::unique_ptr<hnswlib::BruteforceSearch<float>> index_; // labels are slot numbers
+    std::vector<Slot> slots_;
+    size_t next_slot_ = 0;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+};
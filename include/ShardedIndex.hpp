@@ -0,0 +1,72 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+#include "hnswlib/hnswlib.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// The HNSW graph split into independent shards by id (id % shards, so sequential
+// ids take turns). Each query walks every shard at once on a thread pool shared
+// by every index in the process, and the per-shard results are merged nearest
+// first; batches of inserts go to their shards in parallel. A single shard is a plain HNSW index and runs
+// everything on the calling thread. As in hnswlib, inserts, searches and find() may
+// run at once; everything else needs MemoryManager's mutex and no insert in flight.
+class ShardedIndex
+{
+public:
+    using Index = hnswlib::HierarchicalNSW<float>;
+    using Ranked = std::vector<std::pair<float, hnswlib::labeltype>>;
+    using StopFactory = std::function<std::unique_ptr<hnswlib::BaseSearchStopCondition<float>>()>;
+
+    // Holds max_elements vectors in total across its shards; has none until reset()
+    ShardedIndex(hnswlib::SpaceInterface<float> *space, size_t max_elements);
+
+    // Replaces every shard with an empty one
+    void reset(size_t shards, size_t M, size_t ef_construction);
+    size_t shardCount() const { return shards_.size(); }
+    size_t shardOf(long id) const { return (size_t)id % shards_.size(); }
+    // Elements each shard has room for
+    size_t shardCapacity() const;
+    Index &shard(size_t i) { return *shards_[i]; }
+    void setShard(size_t i, std::unique_ptr<Index> index) { shards_[i] = std::move(index); }
+
+    // Throws std::runtime_error if the id's shard is full
+    void addPoint(const float *vector, long id);
+    // Each shard's points are inserted on their own thread. A point that fails is
+    // logged and skipped.
+    void addPoints(const std::vector<std::pair<long, const float *>> &points);
+    // nullptr if id is not in the index
+    const float *find(long id) const;
+
+    // Nearest k (distance, id) pairs over all shards, nearest first
+    Ranked searchKnn(const float *query, size_t k, size_t ef, hnswlib::BaseFilterFunctor *filter = nullptr);
+    // Each shard is walked with its own stop condition from make_stop; at most
+    // limit pairs, nearest first
+    Ranked searchStopCondition(const float *query, const StopFactory &make_stop, size_t limit,
+                               hnswlib::BaseFilterFunctor *filter = nullptr);
+
+    // Runs f(i) for every i < n on the pool the shards use, the calling thread
+    // included; f may itself search the index
+    void forEach(size_t n, const std::function<void(size_t)> &f);
+
+    // Elements over all shards
+    size_t size() const;
+    size_t ef() const { return shards_[0]->ef_; }
+    void clearDirty();
+    // Same estimate as for one index: elements in use plus the per-capacity lock tables
+    size_t memoryUsage() const;
+
+private:
+    // Runs f(shard) for every shard, in parallel if there is a pool
+    void forEachShard(const std::function<void(size_t)> &f);
+    // Merges per-shard lists that are each nearest first
+    static Ranked merge(const std::vector<Ranked> &parts, size_t limit);
+
+    hnswlib::SpaceInterface<float> *space_;
+    size_t max_elements_;
+    std::vector<std::unique_ptr<Index>> shards_;
+    ThreadPool *pool_; // nullptr on a single core
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "LocalProtocol.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Shared-memory request channel for latency-critical local clients. The server
+// creates a POSIX shared memory object holding a ring of request slots and a
+// results arena; clients map it, claim a free slot with a CAS, write the request
+// in place and poll for the result, so a round trip needs no syscalls while both
+// sides are busy. Requests and responses use the format of LocalProtocol.hpp.
+//
+// Layout: ShmHeader, ShmSlot[slot_count], then the results arena of
+// slot_count * response_capacity bytes. Each slot's response is written into its
+// own region of the arena and located by response_offset / response_length.
+//
+// Slot states: FREE -> (client) CLAIMED -> (client) REQUEST -> (server)
+// PROCESSING -> (server) DONE -> (client) FREE. A client that times out withdraws
+// a REQUEST (-> FREE) or abandons a PROCESSING slot (-> ABANDONED), which the
+// server frees instead of answering. Each claim records the client's pid and a
+// fresh epoch in the slot's state word; the server frees slots left CLAIMED or
+// DONE by clients that have exited, and the epoch keeps it from freeing a slot
+// that has been claimed again since it looked.
+
+constexpr char SHM_MAGIC[8] = {'J', 'M', 'E', 'M', 'S', 'H', 'M', '2'};
+
+struct ShmHeader
+{
+    char magic[8];
+    uint32_t slot_count;
+    uint32_t request_capacity;
+    uint32_t response_capacity;
+    uint32_t reserved;
+    std::atomic<uint32_t> server_running; // cleared when the server stops; clients fail fast
+};
+
+struct ShmSlot
+{
+    enum State : uint32_t
+    {
+        FREE = 0,
+        CLAIMED = 1,
+        REQUEST = 2,
+        PROCESSING = 3,
+        DONE = 4,
+        ABANDONED = 5
+    };
+
+    // State in the low 8 bits, the claim's epoch in the next 24 and the owning
+    // client's pid in the high 32, so a claim and its owner are one CAS
+    std::atomic<uint64_t> word;
+    uint32_t request_length;
+    uint32_t status; // LocalStatus
+    uint32_t response_length;
+    uint32_t reserved;
+    uint64_t response_offset; // from the start of the results arena
+
+    static State stateOf(uint64_t word) { return (State)(word & 0xFF); }
+    static uint32_t epochOf(uint64_t word) { return (word >> 8) & 0xFFFFFF; }
+    static uint32_t ownerOf(uint64_t word) { return word >> 32; }
+    static uint64_t pack(State state, uint32_t epoch, uint32_t owner)
+    {
+        return (uint64_t)owner << 32 | (uint64_t)(epoch & 0xFFFFFF) << 8 | state;
+    }
+    // The same claim in another state
+    static uint64_t withState(uint64_t word, State state) { return (word & ~(uint64_t)0xFF) | state; }
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "shared-memory atomics must be lock-free");
+
+// Maps the channel and exposes its sections. Shared by server and clients.
+class ShmRegion
+{
+public:
+    ShmRegion() = default;
+    ~ShmRegion();
+
+    ShmRegion(const ShmRegion &) = delete;
+    ShmRegion &operator=(const ShmRegion &) = delete;
+
+    // Throws std::runtime_error. create replaces any existing object of that name.
+    void create(const std::string &name, uint32_t slot_count, uint32_t request_capacity, uint32_t response_capacity);
+    void open(const std::string &name);
+    void close();
+
+    ShmHeader &header() const { return *header_; }
+    ShmSlot &slot(size_t i) const { return slots_[i]; }
+    char *request(size_t i) const { return requests_ + i * header_->request_capacity; }
+    char *arena() const { return arena_; }
+    char *response(size_t i) const { return arena_ + i * (size_t)header_->response_capacity; }
+
+private:
+    // Maps size bytes of fd and closes it
+    void map(int fd, size_t size);
+    // Points the section pointers past the mapped header
+    void layout();
+
+    void *base_ = nullptr;
+    size_t size_ = 0;
+    ShmHeader *header_ = nullptr;
+    ShmSlot *slots_ = nullptr;
+    char *requests_ = nullptr;
+    char *arena_ = nullptr;
+};
+
+// Server side: a pool of threads polling the request slots.
+class ShmServer
+{
+public:
+    ShmServer(MemoryManager &memory, const std::string &name, size_t threads = 1, uint32_t slot_count = 64);
+    ~ShmServer();
+
+    ShmServer(const ShmServer &) = delete;
+    ShmServer &operator=(const ShmServer &) = delete;
+
+    // Throws std::runtime_error.
+    void start();
+    void stop();
+
+    static constexpr uint32_t REQUEST_CAPACITY = 16 << 10;
+    static constexpr uint32_t RESPONSE_CAPACITY = 256 << 10;
+
+private:
+    void poll(size_t first_slot);
+    void process(size_t i, std::string &body);
+    // Frees slots still held by clients that have exited
+    void reclaimSlots();
+
+    MemoryManager &memory_;
+    std::string name_;
+    size_t thread_count_;
+    uint32_t slot_count_;
+    ShmRegion region_;
+    std::atomic<bool> stopping_{false};
+    std::vector<std::thread> threads_;
+};
+
+// Client side. One ShmClient may be shared by several threads; each call uses its own slot.
+class ShmClient
+{
+public:
+    // Throws std::runtime_error if the channel does not exist.
+    explicit ShmClient(const std::string &name);
+
+    // Sends a request and waits for its response. Throws std::runtime_error if no
+    // slot frees up or the server does not answer within timeout_us, or if the
+    // server stops meanwhile.
+    LocalStatus call(std::string_view request, std::string &response, long timeout_us = 1000000);
+
+private:
+    ShmRegion region_;
+    std::atomic<uint32_t> next_slot_{0};
+    uint32_t pid_;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// One entry as seen by a reader of the ring. content points into EntryStore's
+// arena, which never moves or frees bytes while the store is live.
+struct RecentEntry
+{
+    long id;
+    int64_t timestamp;
+    uint8_t role;
+    const char *content;
+    uint32_t content_length;
+    const char *json; // cached serialization, also in the arena
+    uint32_t json_length;
+    const char *tags; // '\0'-separated, also in the arena
+    uint32_t tags_length;
+};
+
+// Fixed-capacity ring of the most recent entries. There is a single writer
+// (add(), which runs under MemoryManager's mutex); readers take no lock. Each
+// slot is guarded by a sequence number: odd while it is being written, and
+// 2 * (position + 1) once the entry at that position is complete. A reader
+// that sees a slot change under it stops there, so a snapshot is always a
+// contiguous run of the newest entries.
+class ShortTermRing
+{
+public:
+    explicit ShortTermRing(size_t capacity);
+
+    ShortTermRing(const ShortTermRing &) = delete;
+    ShortTermRing &operator=(const ShortTermRing &) = delete;
+
+    // Single writer only
+    void push(const RecentEntry &entry);
+    // Not safe against concurrent readers; only used while no requests are served
+    void clear();
+
+    // Up to n of the newest entries, oldest first
+    std::vector<RecentEntry> snapshot(size_t n) const;
+
+    size_t size() const;
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<long> id{0};
+        std::atomic<int64_t> timestamp{0};
+        std::atomic<uint8_t> role{0};
+        std::atomic<const char *> content{nullptr};
+        std::atomic<uint32_t> content_length{0};
+        std::atomic<const char *> json{nullptr};
+        std::atomic<uint32_t> json_length{0};
+        std::atomic<const char *> tags{nullptr};
+        std::atomic<uint32_t> tags_length{0};
+    };
+
+    size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+    // Number of entries ever pushed; the next entry goes to slots_[head_ % capacity_]
+    std::atomic<uint64_t> head_{0};
+};
+
+// A ShortTermRing per session, in a hash map split into independently locked
+// shards. A reader locks one shard only long enough to find its session's ring,
+// then snapshots the ring without locks, so a session's window costs O(window)
+// however many sessions there are. Pushes come from the same single writer as
+// ShortTermRing's and hold their shard's lock across the lookup and the push,
+// so eviction on another thread never drops an entry. Sessions are kept in an
+// intrusive least recently used list; those unused for idle_seconds are dropped
+// by evictIdle(), and the least recently used one makes room once max_sessions
+// are open, each in O(1) per session dropped.
+class SessionRings
+{
+public:
+    SessionRings(size_t capacity, size_t max_sessions, int64_t idle_seconds);
+    ~SessionRings();
+
+    SessionRings(const SessionRings &) = delete;
+    SessionRings &operator=(const SessionRings &) = delete;
+
+    // Single writer only; now is in seconds since the epoch
+    void push(std::string_view session, const RecentEntry &entry, int64_t now);
+    // Up to n of the session's newest entries, oldest first; empty for an unknown session
+    std::vector<RecentEntry> snapshot(std::string_view session, size_t n) const;
+    // Entries in the session's window
+    size_t size(std::string_view session) const;
+    // Drops the sessions idle since before now - idle_seconds; returns how many
+    size_t evictIdle(int64_t now);
+    void clear();
+
+    size_t sessions() const;
+    bool enabled() const { return max_sessions_ > 0; }
+
+private:
+    struct Session
+    {
+        Session(std::string_view name, size_t capacity) : name(name), ring(capacity) {}
+        const std::string name;
+        ShortTermRing ring;
+        std::atomic<int64_t> last_used{0};
+        // LRU links, guarded by lru_mtx_
+        Session *newer = nullptr;
+        Session *older = nullptr;
+        bool linked = false;
+    };
+
+    struct Shard
+    {
+        mutable std::shared_mutex mtx;
+        // shared_ptr so a reader keeps an evicted session's ring alive while it copies it
+        std::unordered_map<std::string, std::shared_ptr<Session>> sessions;
+    };
+
+    static constexpr size_t SHARDS = 16;
+
+    Shard &shardFor(std::string_view session);
+    const Shard &shardFor(std::string_view session) const;
+    std::shared_ptr<Session> find(std::string_view session) const;
+    // Caller holds lru_mtx_
+    void link(Session *session);
+    void unlink(Session *session);
+    // Moves session to the newest end; caller holds its shard's lock
+    void touch(Session *session);
+    // Drops the least recently used session if it was last used before cutoff,
+    // counting it in dropped. False once there is no such session; a session used
+    // again while it is being dropped is kept.
+    bool evictOldest(int64_t cutoff, size_t &dropped);
+
+    size_t capacity_;
+    size_t max_sessions_;
+    int64_t idle_seconds_;
+    Shard shards_[SHARDS];
+    std::atomic<size_t> count_{0};
+
+    // Taken after a shard's lock, never before one
+    std::mutex lru_mtx_;
+    Session *newest_ = nullptr;
+    Session *oldest_ = nullptr;
+};
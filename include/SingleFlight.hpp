@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Coalesces identical concurrent calls: the first caller for a key runs the
+// computation and callers arriving while it is in flight wait for its result
+// instead of repeating the work.
+//
+// Flights live in a fixed table of slots. A slot's state is FREE, BUSY (being
+// claimed or torn down) or the hash of the key in flight. Starting, finishing
+// and tearing down a flight with no followers takes only atomic operations;
+// the slot mutex is used only to park and wake followers. When every probed
+// slot holds another key the call simply runs uncoalesced.
+template <typename Result, size_t SLOTS = 64>
+class SingleFlight
+{
+public:
+    // Returns compute()'s result, possibly one computed by a concurrent caller
+    // with the same key. Exceptions from compute() reach every caller sharing it.
+    template <typename Compute>
+    Result run(const std::string &key, Compute &&compute)
+    {
+        uint64_t hash = std::hash<std::string>()(key) | 2; // never FREE or BUSY
+
+        for (size_t probe = 0; probe < PROBES; ++probe)
+        {
+            Slot &slot = slots_[(hash + probe) % SLOTS];
+            uint64_t state = slot.state.load(std::memory_order_acquire);
+            if (state == hash)
+            {
+                Result result;
+                if (follow(slot, hash, key, result))
+                    return result;
+                continue;
+            }
+            uint64_t expected = FREE;
+            if (state == FREE && slot.state.compare_exchange_strong(expected, BUSY, std::memory_order_acquire))
+                return lead(slot, hash, key, compute);
+        }
+        return compute();
+    }
+
+    // Calls answered with another caller's result
+    size_t sharedCount() const { return shared_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint64_t FREE = 0;
+    static constexpr uint64_t BUSY = 1;
+    static constexpr size_t PROBES = 4;
+
+    struct Slot
+    {
+        std::atomic<uint64_t> state{FREE};
+        std::atomic<uint32_t> waiters{0};
+        std::atomic<bool> done{false};
+        std::string key;
+        Result result{};
+        std::exception_ptr error;
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+
+    template <typename Compute>
+    Result lead(Slot &slot, uint64_t hash, const std::string &key, Compute &compute)
+    {
+        slot.key = key;
+        slot.error = nullptr;
+        slot.done.store(false, std::memory_order_relaxed);
+        slot.state.store(hash, std::memory_order_seq_cst);
+
+        Result result{};
+        try
+        {
+            result = compute();
+            slot.result = result;
+        }
+        catch (...)
+        {
+            slot.error = std::current_exception();
+        }
+
+        slot.done.store(true, std::memory_order_seq_cst);
+        if (slot.waiters.load(std::memory_order_seq_cst) > 0)
+        {
+            std::lock_guard<std::mutex> lock(slot.mtx);
+            slot.cv.notify_all();
+        }
+
+        // Stop new followers from attaching, then wait for attached ones to copy the result
+        slot.state.store(BUSY, std::memory_order_seq_cst);
+        while (slot.waiters.load(std::memory_order_seq_cst) > 0)
+            std::this_thread::yield();
+        std::exception_ptr error = slot.error;
+        slot.result = Result{};
+        slot.error = nullptr;
+        slot.state.store(FREE, std::memory_order_release);
+
+        if (error)
+            std::rethrow_exception(error);
+        return result;
+    }
+
+    // False if the slot moved on to another flight before we attached
+    bool follow(Slot &slot, uint64_t hash, const std::string &key, Result &result)
+    {
+        slot.waiters.fetch_add(1, std::memory_order_seq_cst);
+        bool attached = slot.state.load(std::memory_order_seq_cst) == hash && slot.key == key;
+        std::exception_ptr error;
+        if (attached)
+        {
+            if (!slot.done.load(std::memory_order_acquire))
+            {
+                std::unique_lock<std::mutex> lock(slot.mtx);
+                slot.cv.wait(lock, [&slot]
+                             { return slot.done.load(std::memory_order_acquire); });
+            }
+            result = slot.result;
+            error = slot.error;
+        }
+        slot.waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+        if (!attached)
+            return false;
+        shared_.fetch_add(1, std::memory_order_relaxed);
+        if (error)
+            std::rethrow_exception(error);
+        return true;
+    }
+
+    Slot slots_[SLOTS];
+    std::atomic<size_t> shared_{0};
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "MemoryManager.hpp"
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+// Named stores ("tenants") served by one process. The default store lives in
+// config.data_dir as before and stays loaded; tenant stores live in
+// data_dir/tenants/<tenant>, are opened on first use and are closed least
+// recently used first whenever the loaded stores together use more than
+// memory_budget bytes. Every store shares one embedding model.
+//
+// The budget is checked on a background thread from each store's lock-free
+// usage estimate, and evicted stores write their final checkpoint there too, so
+// a request never waits on another tenant. A store is only closed while no
+// caller holds it, and a tenant being closed is not reopened until its final
+// checkpoint has been written.
+class StoreRegistry
+{
+public:
+    StoreRegistry(const std::string &model_path, const MemoryConfig &config, size_t memory_budget);
+    ~StoreRegistry();
+
+    StoreRegistry(const StoreRegistry &) = delete;
+    StoreRegistry &operator=(const StoreRegistry &) = delete;
+
+    MemoryManager &defaultStore() { return *default_store_; }
+    // The default store for an empty tenant. Throws std::invalid_argument if
+    // !validTenant(tenant).
+    std::shared_ptr<MemoryManager> get(const std::string &tenant);
+
+    // 1 to 64 characters from [A-Za-z0-9_-], so the name is a safe directory name
+    static bool validTenant(const std::string &tenant);
+
+    size_t loadedStores();
+    size_t memoryBudget() const { return memory_budget_; }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<MemoryManager>>;
+
+    void trimLoop();
+    void evictOverBudget();
+
+    MemoryConfig config_;
+    size_t memory_budget_;
+    SharedModel model_;
+    std::shared_ptr<MemoryManager> default_store_;
+
+    std::mutex mtx_;
+    std::condition_variable closed_cv_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    std::unordered_set<std::string> closing_; // evicted, final checkpoint in progress
+    size_t gets_since_trim_ = 0;
+    std::condition_variable trim_cv_;
+    bool trim_requested_ = false;
+    bool stopping_ = false;
+    std::thread trimmer_;
+};
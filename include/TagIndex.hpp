@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Compressed set of 32-bit ids in the style of a roaring bitmap. Ids are split by
+// their high 16 bits into containers; a container is a sorted array of the low
+// halves while it holds at most ARRAY_MAX ids, and a 65536-bit bitset beyond that.
+// Operations between two bitsets run a 64-bit word at a time in plain loops the
+// compiler vectorizes.
+class TagBitmap
+{
+public:
+    void add(uint32_t id);
+    bool contains(uint32_t id) const;
+    size_t cardinality() const { return cardinality_; }
+    bool empty() const { return cardinality_ == 0; }
+    size_t memoryUsage() const;
+
+    TagBitmap &operator&=(const TagBitmap &other);
+    TagBitmap &operator|=(const TagBitmap &other);
+
+    // Calls f(id) for every id in ascending order, stopping early if it returns false
+    template <typename F>
+    void forEach(F f) const { forEachFrom(0, f); }
+    // The same for the ids from first on, skipping the containers below it
+    template <typename F>
+    void forEachFrom(uint32_t first, F f) const;
+
+private:
+    static constexpr size_t ARRAY_MAX = 4096;
+    static constexpr size_t BITSET_WORDS = 65536 / 64;
+
+    struct Container
+    {
+        uint16_t key = 0;
+        uint32_t cardinality = 0;
+        std::vector<uint16_t> array; // sorted; used while bits is empty
+        std::vector<uint64_t> bits;  // BITSET_WORDS words once the container is dense
+
+        bool dense() const { return !bits.empty(); }
+        bool contains(uint16_t low) const;
+        void add(uint16_t low);
+        void toBitset();
+        void toArray();
+    };
+
+    static Container intersect(const Container &a, const Container &b);
+    static void unite(Container &a, const Container &b);
+    const Container *find(uint16_t key) const;
+
+    std::vector<Container> containers_; // sorted by key
+    size_t cardinality_ = 0;
+};
+
+template <typename F>
+void TagBitmap::forEachFrom(uint32_t first, F f) const
+{
+    auto start = std::lower_bound(containers_.begin(), containers_.end(), first >> 16,
+                                  [](const Container &c, uint32_t key) { return c.key < key; });
+    for (auto it = start; it != containers_.end(); ++it)
+    {
+        const Container &c = *it;
+        uint32_t high = (uint32_t)c.key << 16;
+        if (!c.dense())
+        {
+            for (uint16_t low : c.array)
+            {
+                if ((high | low) >= first && !f(high | low))
+                    return;
+            }
+            continue;
+        }
+        for (size_t w = (high >= first ? 0 : (first & 0xFFFF) / 64); w < BITSET_WORDS; ++w)
+        {
+            for (uint64_t word = c.bits[w]; word; word &= word - 1)
+            {
+                uint32_t id = high | (uint32_t)(w * 64 + __builtin_ctzll(word));
+                if (id >= first && !f(id))
+                    return;
+            }
+        }
+    }
+}
+
+// Bitmap of entry ids per tag
+class TagIndex
+{
+public:
+    // Bitmap for tag, created empty if needed. References stay valid until clear().
+    TagBitmap &bitmap(std::string_view tag);
+    // nullptr if no entry has the tag
+    const TagBitmap *find(std::string_view tag) const;
+    void clear() { bitmaps_.clear(); }
+
+    size_t size() const { return bitmaps_.size(); }
+    size_t memoryUsage() const;
+
+private:
+    std::unordered_map<std::string, TagBitmap> bitmaps_;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for fork-join loops. The calling thread works on
+// its own loop too, so a pool of n - 1 workers runs n iterations at once, and a
+// pool with no workers runs everything on the caller.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Calls f(i) for every i in [0, n) and returns once all calls have. Rethrows the
+    // first exception any of them threw, after the rest have finished.
+    void forEach(size_t n, const std::function<void(size_t)> &f);
+
+    size_t workers() const { return workers_.size(); }
+
+private:
+    struct Loop
+    {
+        const std::function<void(size_t)> *f;
+        size_t n;
+        size_t next = 0; // next index to hand out
+        size_t done = 0;
+        std::exception_ptr error;
+    };
+
+    // Claims the next index of loop; caller holds mtx_
+    size_t claim(Loop &loop);
+    // Runs f(i) without mtx_, then records it as done
+    void run(Loop &loop, size_t i, std::unique_lock<std::mutex> &lock);
+    void work();
+
+    std::mutex mtx_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    std::deque<Loop *> loops_; // loops with indexes left to hand out
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+};
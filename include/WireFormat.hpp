@@ -0,0 +1,39 @@
+#pragma once
+
+#include "crow.h"
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+// Encodings negotiated per request. Request bodies are read according to
+// Content-Type and responses written according to Accept; anything else,
+// including a missing header, means JSON.
+//
+//   application/json          JSON (compact unless ?pretty=1)
+//   application/cbor          CBOR (RFC 8949)
+//   application/msgpack       MessagePack (also application/x-msgpack)
+//   application/octet-stream  raw little-endian float32 array, for vectors only
+enum class WireFormat
+{
+    Json,
+    Cbor,
+    MsgPack,
+    Float32
+};
+
+WireFormat requestFormat(const crow::request &req);
+// Float32 is only offered by endpoints that return a bare vector
+WireFormat responseFormat(const crow::request &req, bool allow_float32 = false);
+const char *contentType(WireFormat format);
+
+// Throws nlohmann::json::exception if the body is malformed.
+// Float32 bodies are not documents; use decodeFloat32().
+nlohmann::json decodeBody(const std::string &body, WireFormat format);
+std::string encodeBody(const nlohmann::json &value, WireFormat format, bool pretty = false);
+
+// Throws std::invalid_argument if the size is not a multiple of 4 bytes.
+std::vector<float> decodeFloat32(const std::string &body);
+std::string encodeFloat32(const std::vector<float> &values);
+
+// A 200 response with the body and its Content-Type header
+crow::response makeResponse(WireFormat format, std::string body);
@@ -9,6 +9,12 @@
 #include <unordered_set>
 #include <list>
 #include <memory>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace hnswlib {
 typedef unsigned int tableint;
@@ -19,6 +25,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
  public:
     static const tableint MAX_LABEL_OPERATION_LOCKS = 65536;
     static const unsigned char DELETE_MARK = 0x01;
+    static constexpr uint64_t DELTA_MAGIC = 0x31544c4457534e48;  // "HNSWDLT1"
 
     size_t max_elements_{0};
     mutable std::atomic<size_t> cur_element_count{0};  // current number of elements
@@ -70,6 +77,16 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::mutex deleted_elements_lock;  // lock for deleted_elements
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
 
+    // Set by loadIndexMapped: level 0 and the upper link lists point into private (copy-on-write)
+    // mappings of the index file instead of malloc'd buffers
+    char *level0_mapping_{nullptr};
+    size_t level0_mapping_size_{0};
+    char *file_mapping_{nullptr};
+    size_t file_mapping_size_{0};
+
+    // Elements whose level 0 block or link lists changed since the last saveDelta/clearDirty
+    std::unique_ptr<std::atomic<bool>[]> dirty_elements_;
+
 
     HierarchicalNSW(SpaceInterface<dist_t> *s) {
     }
@@ -126,6 +143,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         data_level0_memory_ = (char *) malloc(max_elements_ * size_data_per_element_);
         if (data_level0_memory_ == nullptr)
             throw std::runtime_error("Not enough memory");
+        resetDirtyFlags(max_elements_);
 
         cur_element_count = 0;
 
@@ -149,19 +167,68 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void clear() {
-        free(data_level0_memory_);
+        if (level0_mapping_) {
+            unmapMemory(level0_mapping_, level0_mapping_size_);
+            level0_mapping_ = nullptr;
+            level0_mapping_size_ = 0;
+        } else {
+            free(data_level0_memory_);
+        }
         data_level0_memory_ = nullptr;
         for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
+            if (element_levels_[i] > 0 && !isInFileMapping(linkLists_[i]))
                 free(linkLists_[i]);
         }
         free(linkLists_);
         linkLists_ = nullptr;
+        if (file_mapping_) {
+            unmapMemory(file_mapping_, file_mapping_size_);
+            file_mapping_ = nullptr;
+            file_mapping_size_ = 0;
+        }
         cur_element_count = 0;
         visited_list_pool_.reset(nullptr);
     }
 
 
+    void resetDirtyFlags(size_t max_elements) {
+        dirty_elements_.reset(new std::atomic<bool>[max_elements]);
+        for (size_t i = 0; i < max_elements; i++)
+            dirty_elements_[i].store(false, std::memory_order_relaxed);
+    }
+
+
+    inline void markDirty(tableint internal_id) {
+        dirty_elements_[internal_id].store(true, std::memory_order_relaxed);
+    }
+
+
+    size_t getDirtyCount() const {
+        size_t count = 0;
+        for (size_t i = 0; i < cur_element_count; i++)
+            count += dirty_elements_[i].load(std::memory_order_relaxed);
+        return count;
+    }
+
+
+    void clearDirty() {
+        for (size_t i = 0; i < max_elements_; i++)
+            dirty_elements_[i].store(false, std::memory_order_relaxed);
+    }
+
+
+    bool isInFileMapping(const char *ptr) const {
+        return file_mapping_ && ptr >= file_mapping_ && ptr < file_mapping_ + file_mapping_size_;
+    }
+
+
+    static void unmapMemory(char *ptr, size_t size) {
+#ifndef _WIN32
+        munmap(ptr, size);
+#endif
+    }
+
+
     struct CompareByFirst {
         constexpr bool operator()(std::pair<dist_t, tableint> const& a,
             std::pair<dist_t, tableint> const& b) const noexcept {
@@ -540,6 +607,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 throw std::runtime_error("The newly inserted element should have blank link list");
             }
             setListCount(ll_cur, selectedNeighbors.size());
+            markDirty(cur_c);
             tableint *data = (tableint *) (ll_cur + 1);
             for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
                 if (data[idx] && !isUpdate)
@@ -583,6 +651,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
             // If cur_c is already present in the neighboring connections of `selectedNeighbors[idx]` then no need to modify any connections or run the heuristics.
             if (!is_cur_c_present) {
+                markDirty(selectedNeighbors[idx]);
                 if (sz_link_list_other < Mcurmax) {
                     data[sz_link_list_other] = cur_c;
                     setListCount(ll_other, sz_link_list_other + 1);
@@ -640,11 +709,28 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
 
+        std::unique_ptr<std::atomic<bool>[]> dirty_old(dirty_elements_.release());
+        resetDirtyFlags(new_max_elements);
+        for (size_t i = 0; i < cur_element_count; i++)
+            dirty_elements_[i].store(dirty_old[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+
         // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
-        if (data_level0_memory_new == nullptr)
-            throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
-        data_level0_memory_ = data_level0_memory_new;
+        if (level0_mapping_) {
+            // a mapped base layer cannot grow in place, move it to the heap
+            char * data_level0_memory_new = (char *) malloc(new_max_elements * size_data_per_element_);
+            if (data_level0_memory_new == nullptr)
+                throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
+            memcpy(data_level0_memory_new, data_level0_memory_, cur_element_count * size_data_per_element_);
+            unmapMemory(level0_mapping_, level0_mapping_size_);
+            level0_mapping_ = nullptr;
+            level0_mapping_size_ = 0;
+            data_level0_memory_ = data_level0_memory_new;
+        } else {
+            char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+            if (data_level0_memory_new == nullptr)
+                throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
+            data_level0_memory_ = data_level0_memory_new;
+        }
 
         // Reallocate all other layers
         char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
@@ -713,6 +799,140 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+    /*
+    * Writes only the elements modified since the previous saveDelta (or clearDirty): their level 0 block
+    * and upper link lists, plus the element count and entry point. Applying the deltas in order to the
+    * index they were taken against reproduces the current graph. Returns the number of elements written.
+    */
+    size_t saveDelta(const std::string &location) {
+        std::vector<tableint> ids;
+        size_t element_count = cur_element_count;
+        for (tableint i = 0; i < element_count; i++) {
+            if (dirty_elements_[i].exchange(false, std::memory_order_relaxed))
+                ids.push_back(i);
+        }
+
+        std::ofstream output(location, std::ios::binary);
+        writeBinaryPOD(output, DELTA_MAGIC);
+        writeBinaryPOD(output, element_count);
+        writeBinaryPOD(output, maxlevel_);
+        writeBinaryPOD(output, enterpoint_node_);
+        size_t num_ids = ids.size();
+        writeBinaryPOD(output, num_ids);
+
+        for (tableint id : ids) {
+            std::unique_lock <std::mutex> lock(link_list_locks_[id]);
+            writeBinaryPOD(output, id);
+            output.write(data_level0_memory_ + id * size_data_per_element_ + offsetLevel0_, size_data_per_element_);
+            unsigned int linkListSize = element_levels_[id] > 0 ? size_links_per_element_ * element_levels_[id] : 0;
+            writeBinaryPOD(output, linkListSize);
+            if (linkListSize)
+                output.write(linkLists_[id], linkListSize);
+        }
+        output.close();
+
+        if (!output) {
+            for (tableint id : ids)
+                markDirty(id);
+            throw std::runtime_error("Failed to write index delta");
+        }
+        return ids.size();
+    }
+
+
+    // Whether every link list of id holds at most M entries, each below element_count
+    bool linksValid(tableint id, size_t element_count) const {
+        for (int level = 0; level <= element_levels_[id]; level++) {
+            linklistsizeint *list = level ? get_linklist(id, level) : get_linklist0(id);
+            size_t size = getListCount(list);
+            if (size > (level ? maxM_ : maxM0_))
+                return false;
+            tableint *links = (tableint *) (list + 1);
+            for (size_t i = 0; i < size; i++) {
+                if (links[i] >= element_count)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+
+    void applyDelta(const std::string &location) {
+        std::ifstream input(location, std::ios::binary);
+        if (!input.is_open())
+            throw std::runtime_error("Cannot open file");
+
+        uint64_t magic;
+        size_t element_count, num_ids;
+        int maxlevel;
+        tableint enterpoint_node;
+        readBinaryPOD(input, magic);
+        readBinaryPOD(input, element_count);
+        readBinaryPOD(input, maxlevel);
+        readBinaryPOD(input, enterpoint_node);
+        readBinaryPOD(input, num_ids);
+        if (!input || magic != DELTA_MAGIC || element_count < cur_element_count ||
+            (element_count > 0 && (maxlevel < 0 || enterpoint_node >= element_count)))
+            throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+        if (element_count > max_elements_)
+            resizeIndex(element_count);
+
+        for (size_t n = 0; n < num_ids; n++) {
+            tableint id;
+            readBinaryPOD(input, id);
+            if (!input || id >= element_count)
+                throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+
+            bool existed = id < cur_element_count;
+            bool was_deleted = existed && isMarkedDeleted(id);
+            labeltype old_label = existed ? getExternalLabel(id) : 0;
+
+            input.read(data_level0_memory_ + id * size_data_per_element_ + offsetLevel0_, size_data_per_element_);
+            unsigned int linkListSize;
+            readBinaryPOD(input, linkListSize);
+
+            if (existed && element_levels_[id] > 0 && !isInFileMapping(linkLists_[id]))
+                free(linkLists_[id]);
+            if (linkListSize == 0) {
+                element_levels_[id] = 0;
+                linkLists_[id] = nullptr;
+            } else {
+                element_levels_[id] = linkListSize / size_links_per_element_;
+                linkLists_[id] = (char *) malloc(linkListSize);
+                if (linkLists_[id] == nullptr)
+                    throw std::runtime_error("Not enough memory: applyDelta failed to allocate linklist");
+                input.read(linkLists_[id], linkListSize);
+            }
+            if (!input || linkListSize % size_links_per_element_ != 0 || element_levels_[id] > maxlevel ||
+                !linksValid(id, element_count))
+                throw std::runtime_error("Index delta seems to be corrupted or unsupported");
+
+            labeltype label = getExternalLabel(id);
+            if (existed && old_label != label) {
+                auto search = label_lookup_.find(old_label);
+                if (search != label_lookup_.end() && search->second == id)
+                    label_lookup_.erase(search);
+            }
+            label_lookup_[label] = id;
+
+            bool is_deleted = isMarkedDeleted(id);
+            if (is_deleted != was_deleted) {
+                if (is_deleted) {
+                    num_deleted_ += 1;
+                    if (allow_replace_deleted_) deleted_elements.insert(id);
+                } else {
+                    num_deleted_ -= 1;
+                    if (allow_replace_deleted_) deleted_elements.erase(id);
+                }
+            }
+        }
+
+        cur_element_count = element_count;
+        maxlevel_ = maxlevel;
+        enterpoint_node_ = enterpoint_node;
+    }
+
+
     void loadIndex(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
         std::ifstream input(location, std::ios::binary);
 
@@ -791,6 +1011,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         if (linkLists_ == nullptr)
             throw std::runtime_error("Not enough memory: loadIndex failed to allocate linklists");
         element_levels_ = std::vector<int>(max_elements);
+        resetDirtyFlags(max_elements);
         revSize_ = 1.0 / mult_;
         ef_ = 10;
         for (size_t i = 0; i < cur_element_count; i++) {
@@ -822,6 +1043,149 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
+#ifndef _WIN32
+    /*
+    * Loads an index saved by saveIndex without copying it. The file is mapped privately, so pages are
+    * shared with the page cache (and with other processes mapping the same file) until they are written.
+    * The base layer is mapped at the head of an anonymous reservation sized for max_elements, so new
+    * points are appended after the mapped ones; writes to existing elements and link lists copy-on-write.
+    * The file may be replaced (renamed over) while mapped, but must not be truncated or rewritten in place.
+    */
+    void loadIndexMapped(const std::string &location, SpaceInterface<dist_t> *s, size_t max_elements_i = 0) {
+        int fd = open(location.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open file");
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot stat file");
+        }
+        size_t total_filesize = st.st_size;
+
+        clear();
+
+        char *file = total_filesize ? (char *) mmap(nullptr, total_filesize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+                                    : (char *) MAP_FAILED;
+        if (file == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Cannot mmap file");
+        }
+        file_mapping_ = file;
+        file_mapping_size_ = total_filesize;
+
+        size_t pos = 0;
+        auto read_pod = [&](auto &pod) {
+            if (pos + sizeof(pod) > total_filesize) {
+                close(fd);
+                throw std::runtime_error("Index seems to be corrupted or unsupported");
+            }
+            memcpy(&pod, file + pos, sizeof(pod));
+            pos += sizeof(pod);
+        };
+
+        read_pod(offsetLevel0_);
+        read_pod(max_elements_);
+        size_t cur_element_count_file;
+        read_pod(cur_element_count_file);
+
+        size_t max_elements = max_elements_i;
+        if (max_elements < cur_element_count_file)
+            max_elements = max_elements_;
+        max_elements_ = max_elements;
+        read_pod(size_data_per_element_);
+        read_pod(label_offset_);
+        read_pod(offsetData_);
+        read_pod(maxlevel_);
+        read_pod(enterpoint_node_);
+
+        read_pod(maxM_);
+        read_pod(maxM0_);
+        read_pod(M_);
+        read_pod(mult_);
+        read_pod(ef_construction_);
+
+        data_size_ = s->get_data_size();
+        fstdistfunc_ = s->get_dist_func();
+        dist_func_param_ = s->get_dist_func_param();
+
+        size_t level0_pos = pos;
+        size_t level0_bytes = cur_element_count_file * size_data_per_element_;
+
+        /// check if index is ok
+        pos += level0_bytes;
+        for (size_t i = 0; i < cur_element_count_file; i++) {
+            unsigned int linkListSize;
+            read_pod(linkListSize);
+            pos += linkListSize;
+        }
+        if (pos != total_filesize) {
+            close(fd);
+            throw std::runtime_error("Index seems to be corrupted or unsupported");
+        }
+
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t file_offset = level0_pos & ~(page_size - 1);
+        size_t lead = level0_pos - file_offset;
+        level0_mapping_size_ = lead + max_elements * size_data_per_element_;
+        char *region = (char *) mmap(nullptr, level0_mapping_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Not enough memory: loadIndexMapped failed to reserve level0");
+        }
+        level0_mapping_ = region;
+        if (level0_bytes) {
+            void *mapped = mmap(region, lead + level0_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, file_offset);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot mmap level0 of index file");
+            }
+        }
+        close(fd);
+        data_level0_memory_ = region + lead;
+
+        size_links_per_element_ = maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+        size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+        std::vector<std::mutex>(max_elements).swap(link_list_locks_);
+        std::vector<std::mutex>(MAX_LABEL_OPERATION_LOCKS).swap(label_op_locks_);
+
+        visited_list_pool_.reset(new VisitedListPool(1, max_elements));
+
+        linkLists_ = (char **) malloc(sizeof(void *) * max_elements);
+        if (linkLists_ == nullptr)
+            throw std::runtime_error("Not enough memory: loadIndexMapped failed to allocate linklists");
+        element_levels_ = std::vector<int>(max_elements);
+        resetDirtyFlags(max_elements);
+        revSize_ = 1.0 / mult_;
+        ef_ = 10;
+        cur_element_count = cur_element_count_file;
+
+        pos = level0_pos + level0_bytes;
+        for (size_t i = 0; i < cur_element_count; i++) {
+            label_lookup_[getExternalLabel(i)] = i;
+            unsigned int linkListSize;
+            memcpy(&linkListSize, file + pos, sizeof(linkListSize));
+            pos += sizeof(linkListSize);
+            if (linkListSize == 0) {
+                element_levels_[i] = 0;
+                linkLists_[i] = nullptr;
+            } else {
+                element_levels_[i] = linkListSize / size_links_per_element_;
+                linkLists_[i] = file + pos;
+                pos += linkListSize;
+            }
+        }
+
+        for (size_t i = 0; i < cur_element_count; i++) {
+            if (isMarkedDeleted(i)) {
+                num_deleted_ += 1;
+                if (allow_replace_deleted_) deleted_elements.insert(i);
+            }
+        }
+    }
+#endif
+
+
     template<typename data_t>
     std::vector<data_t> getDataByLabel(labeltype label) const {
         // lock all operations with element by label
@@ -875,6 +1239,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         if (!isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId))+2;
             *ll_cur |= DELETE_MARK;
+            markDirty(internalId);
             num_deleted_ += 1;
             if (allow_replace_deleted_) {
                 std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
@@ -917,6 +1282,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         if (isMarkedDeleted(internalId)) {
             unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
             *ll_cur &= ~DELETE_MARK;
+            markDirty(internalId);
             num_deleted_ -= 1;
             if (allow_replace_deleted_) {
                 std::unique_lock <std::mutex> lock_deleted_elements(deleted_elements_lock);
@@ -995,6 +1361,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     void updatePoint(const void *dataPoint, tableint internalId, float updateNeighborProbability) {
         // update the feature vector associated with existing point with new vector
         memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+        markDirty(internalId);
 
         int maxLevelCopy = maxlevel_;
         tableint entryPointCopy = enterpoint_node_;
@@ -1058,6 +1425,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     ll_cur = get_linklist_at_level(neigh, layer);
                     size_t candSize = candidates.size();
                     setListCount(ll_cur, candSize);
+                    markDirty(neigh);
                     tableint *data = (tableint *) (ll_cur + 1);
                     for (size_t idx = 0; idx < candSize; idx++) {
                         data[idx] = candidates.top().second;
@@ -1198,6 +1566,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         tableint enterpoint_copy = enterpoint_node_;
 
         memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_, 0, size_data_per_element_);
+        markDirty(cur_c);
 
         // Initialisation of the data and label
         memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
@@ -1225,7 +1594,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                         tableint *datal = (tableint *) (data + 1);
                         for (int i = 0; i < size; i++) {
                             tableint cand = datal[i];
-                            if (cand < 0 || cand > max_elements_)
+                            if (cand >= max_elements_)
                                 throw std::runtime_error("cand error");
                             dist_t d = fstdistfunc_(data_point, getDataByInternalId(cand), dist_func_param_);
                             if (d < curdist) {
@@ -1269,6 +1638,14 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        return searchKnnEf(query_data, k, ef_, isIdAllowed);
+    }
+
+
+    // searchKnn with a per-query ef instead of the index-wide ef_; safe to call
+    // concurrently with different ef values
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnEf(const void *query_data, size_t k, size_t ef, BaseFilterFunctor* isIdAllowed = nullptr) const {
         std::priority_queue<std::pair<dist_t, labeltype >> result;
         if (cur_element_count == 0) return result;
 
@@ -1289,7 +1666,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 tableint *datal = (tableint *) (data + 1);
                 for (int i = 0; i < size; i++) {
                     tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
+                    if (cand >= max_elements_)
                         throw std::runtime_error("cand error");
                     dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
 
@@ -1306,10 +1683,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         bool bare_bone_search = !num_deleted_ && !isIdAllowed;
         if (bare_bone_search) {
             top_candidates = searchBaseLayerST<true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
         } else {
             top_candidates = searchBaseLayerST<false>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
         }
 
         while (top_candidates.size() > k) {
@@ -1349,7 +1726,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                 tableint *datal = (tableint *) (data + 1);
                 for (int i = 0; i < size; i++) {
                     tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
+                    if (cand >= max_elements_)
                         throw std::runtime_error("cand error");
                     dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
 
@@ -1368,7 +1745,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         size_t sz = top_candidates.size();
         result.resize(sz);
         while (!top_candidates.empty()) {
-            result[--sz] = top_candidates.top();
+            result[--sz] = std::make_pair(top_candidates.top().first, getExternalLabel(top_candidates.top().second));
             top_candidates.pop();
         }
 
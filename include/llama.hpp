@@ -16,8 +16,18 @@ public:
   LlamaEmbeddingGenerator &operator=(const LlamaEmbeddingGenerator &) = delete;
 
   std::vector<float> generateEmbedding(const std::string &text) const;
+  // One embedding per text, in order. Texts are packed as separate sequences into
+  // as few encode calls as the batch size and MAX_SEQUENCES allow.
+  std::vector<std::vector<float>> generateEmbeddings(const std::vector<std::string> &texts) const;
+
+  static constexpr int MAX_SEQUENCES = 8;
 
 private:
+  std::vector<llama_token> tokenize(const std::string &text) const;
+  // Encodes tokens[begin, end) in one batch, one sequence per non-empty text
+  void encode(const std::vector<std::vector<llama_token>> &tokens, size_t begin, size_t end,
+              std::vector<std::vector<float>> &embeddings) const;
+
   llama_model *model_;
   llama_context *ctx_;
   int n_embd_;
@@ -0,0 +1,88 @@
+#ifndef JMEM_MEMORY_C_H
+#define JMEM_MEMORY_C_H
+
+/*
+ * C API for embedding the memory store in-process (libjmemory).
+ *
+ * Ownership: a jmem_store owns every string it hands out. The role and content
+ * pointers in a jmem_entry point into the store and stay valid until
+ * jmem_close(), so results can be read without copying. Arrays of jmem_entry
+ * are always allocated by the caller.
+ *
+ * Functions returning int return JMEM_OK or a negative JMEM_ERR_* code;
+ * jmem_last_error() then describes the failure on the calling thread.
+ * A store may be used from several threads at once.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JMEM_OK 0
+#define JMEM_ERR_INVALID_ARGUMENT -1
+#define JMEM_ERR_RUNTIME -2
+
+typedef struct jmem_store jmem_store;
+
+typedef struct jmem_config
+{
+    const char *data_dir;       /* directory holding MANIFEST and the store files */
+    size_t max_elements;        /* index capacity */
+    int mmap_index;             /* map the index file instead of reading it */
+    int verify_checksums;       /* also checksum the index on open */
+    size_t short_term_capacity; /* entries returned by jmem_recent */
+} jmem_config;
+
+typedef struct jmem_entry
+{
+    int64_t id;
+    int64_t timestamp; /* seconds since the Unix epoch, UTC */
+    const char *role;
+    size_t role_length;
+    const char *content;
+    size_t content_length;
+} jmem_entry;
+
+typedef struct jmem_input
+{
+    const char *role;
+    size_t role_length;
+    const char *content;
+    size_t content_length;
+} jmem_input;
+
+/* Fills config with the server defaults. */
+void jmem_config_init(jmem_config *config);
+
+/* Opens (or creates) the store and loads the embedding model. Loading
+ * continues in the background; calls block until what they need is ready.
+ * Returns NULL on failure. config may be NULL for the defaults. */
+jmem_store *jmem_open(const char *model_path, const jmem_config *config);
+void jmem_close(jmem_store *store);
+
+int jmem_add(jmem_store *store, const char *role, size_t role_length, const char *content,
+             size_t content_length);
+/* Adds count entries with consecutive ids. Their contents are embedded in one
+ * model call and stored under one lock. All or nothing: on any error, none of
+ * them is added. */
+int jmem_add_batch(jmem_store *store, const jmem_input *inputs, size_t count);
+
+/* Writes up to capacity results to out and their number to count. */
+int jmem_search(jmem_store *store, const char *query, size_t query_length, size_t k, jmem_entry *out,
+                size_t capacity, size_t *count);
+int jmem_search_vector(jmem_store *store, const float *vector, size_t dimension, size_t k, jmem_entry *out,
+                       size_t capacity, size_t *count);
+/* The n most recent entries, oldest first. */
+int jmem_recent(jmem_store *store, size_t n, jmem_entry *out, size_t capacity, size_t *count);
+
+size_t jmem_dimension(const jmem_store *store);
+const char *jmem_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
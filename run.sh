@@ -1 +1,19 @@
-g++ src/main.cpp src/MemoryManager.cpp  src/llama.cpp -I ./include -o memory_server -std=c++17 -L./lib -L/usr/local/lib -lopenblas -lpthread -lstdc++fs -fopenmp -lllama -Wl,-rpath,$(pwd)/lib
\ No newline at end of file
+set -e
+mkdir -p build
+
+CXXFLAGS="-std=c++17 -fPIC -I ./include"
+LIBS="-L./lib -L/usr/local/lib -lopenblas -lpthread -lstdc++fs -lrt -fopenmp -lllama -Wl,-rpath,$(pwd)/lib"
+
+# libjmemory: the memory store, embedding generator and C API (include/memory_c.h)
+LIB_SRCS="src/MemoryManager.cpp src/EntryStore.cpp src/ShortTermRing.cpp src/JsonWriter.cpp src/MetadataStore.cpp src/Persistence.cpp src/llama.cpp src/SearchCache.cpp src/TagIndex.cpp src/FreshIndex.cpp src/ShardedIndex.cpp src/ThreadPool.cpp src/StoreRegistry.cpp src/memory_c.cpp src/LocalProtocol.cpp src/ShmChannel.cpp"
+LIB_OBJS=""
+for src in $LIB_SRCS; do
+  obj="build/$(basename "${src%.cpp}").o"
+  g++ $CXXFLAGS -c "$src" -o "$obj"
+  LIB_OBJS="$LIB_OBJS $obj"
+done
+ar rcs build/libjmemory.a $LIB_OBJS
+g++ -shared $LIB_OBJS -o build/libjmemory.so $LIBS
+
+# memory_server: the HTTP and Unix socket front end, linked against the static library
+g++ src/main.cpp src/RequestParser.cpp src/WireFormat.cpp src/LocalServer.cpp build/libjmemory.a $CXXFLAGS -o memory_server $LIBS
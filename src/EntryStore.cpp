@@ -0,0 +1,310 @@
+#include "EntryStore.hpp"
+#include "MetadataStore.hpp"
+#include "JsonWriter.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void EntryStore::grow(long id)
+{
+  if ((size_t)id < roles_.size())
+    return;
+  size_t n = id + 1;
+  timestamps_.resize(n, 0);
+  roles_.resize(n, NO_ENTRY);
+  content_offsets_.resize(n, 0);
+  content_lengths_.resize(n, 0);
+  json_offsets_.resize(n, 0);
+  json_lengths_.resize(n, 0);
+  tag_offsets_.resize(n, 0);
+  tag_lengths_.resize(n, 0);
+}
+
+uint8_t EntryStore::internRole(std::string_view role)
+{
+  uint8_t code = findRole(role);
+  if (code != NO_ENTRY)
+    return code;
+  size_t count = role_count_.load(std::memory_order_acquire);
+  if (count == MAX_ROLES)
+    throw std::runtime_error("Too many distinct roles");
+  role_names_[count] = std::string(role);
+  role_count_.store(count + 1, std::memory_order_release);
+  return count;
+}
+
+uint8_t EntryStore::findRole(std::string_view role) const
+{
+  size_t count = role_count_.load(std::memory_order_acquire);
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (role_names_[i] == role)
+      return i;
+  }
+  return NO_ENTRY;
+}
+
+uint64_t EntryStore::appendBytes(std::string_view bytes)
+{
+  if (bytes.size() > CHUNK_SIZE / 4)
+  {
+    // large contents get a chunk of their own
+    chunks_.emplace_back(new char[bytes.size()]);
+    std::memcpy(chunks_.back().get(), bytes.data(), bytes.size());
+    arena_bytes_ += bytes.size();
+    return (uint64_t)(chunks_.size() - 1) << 32;
+  }
+  if (chunk_used_ + bytes.size() > CHUNK_SIZE)
+  {
+    chunks_.emplace_back(new char[CHUNK_SIZE]);
+    current_chunk_ = chunks_.size() - 1;
+    chunk_used_ = 0;
+    arena_bytes_ += CHUNK_SIZE;
+  }
+  uint64_t offset = ((uint64_t)current_chunk_ << 32) | chunk_used_;
+  std::memcpy(chunks_[current_chunk_].get() + chunk_used_, bytes.data(), bytes.size());
+  chunk_used_ += bytes.size();
+  return offset;
+}
+
+const char *EntryStore::arenaData(uint64_t offset) const
+{
+  return chunks_[offset >> 32].get() + (offset & 0xFFFFFFFFu);
+}
+
+const char *EntryStore::contentData(long id) const
+{
+  if (content_lengths_[id] == 0)
+    return "";
+  return arenaData(content_offsets_[id]);
+}
+
+void EntryStore::putJson(long id, const std::vector<std::string_view> &tags)
+{
+  json_scratch_.clear();
+  appendEntryJson(json_scratch_, id, timestamps_[id], role(id), content(id), tags);
+  json_offsets_[id] = appendBytes(json_scratch_);
+  json_lengths_[id] = json_scratch_.size();
+}
+
+std::vector<std::string_view> EntryStore::unpackTags(std::string_view packed)
+{
+  std::vector<std::string_view> tags;
+  while (!packed.empty())
+  {
+    size_t end = packed.find('\0');
+    tags.push_back(packed.substr(0, end));
+    packed = end == std::string_view::npos ? std::string_view() : packed.substr(end + 1);
+  }
+  return tags;
+}
+
+// Stores the packed tags; adding the id to the tag bitmaps is left to the caller
+void EntryStore::putTags(long id, const std::vector<std::string_view> &tags)
+{
+  std::string &packed = tag_scratch_;
+  packed.clear();
+  for (std::string_view tag : tags)
+  {
+    if (!packed.empty())
+      packed.push_back('\0');
+    packed.append(tag);
+  }
+  tag_offsets_[id] = packed.empty() ? 0 : appendBytes(packed);
+  tag_lengths_[id] = packed.size();
+}
+
+// Gaps take the timestamp of the entry after them, so the column stays sorted across them
+void EntryStore::putTimestamp(long id, int64_t timestamp)
+{
+  timestamps_[id] = timestamp;
+  for (long gap = id - 1; gap >= 0 && roles_[gap] == NO_ENTRY; --gap)
+    timestamps_[gap] = timestamp;
+  // Slots after id only hold a timestamp once some entry after them has been stored;
+  // while load() fills the columns in id order the last slot is still empty
+  bool later = (size_t)id + 1 < roles_.size() && roles_.back() != NO_ENTRY;
+  if ((id > 0 && timestamps_[id - 1] > timestamp) || (later && timestamps_[id + 1] < timestamp))
+    timestamps_sorted_ = false;
+}
+
+void EntryStore::putRole(long id, uint8_t code)
+{
+  roles_[id] = code;
+  if ((unsigned long)id > UINT32_MAX)
+    role_ids_complete_ = false;
+  else
+    role_ids_[code].add(id);
+}
+
+long EntryStore::lowerBoundTime(int64_t t) const
+{
+  if (!timestamps_sorted_)
+    return 0;
+  return std::lower_bound(timestamps_.begin(), timestamps_.end(), t) - timestamps_.begin();
+}
+
+void EntryStore::checkTags(const std::vector<std::string_view> &tags)
+{
+  for (std::string_view tag : tags)
+  {
+    if (tag.empty() || tag.find('\0') != std::string_view::npos)
+      throw std::invalid_argument("Tags must be non-empty and must not contain NUL");
+  }
+}
+
+void EntryStore::put(long id, int64_t timestamp, std::string_view role, std::string_view content,
+                     const std::vector<std::string_view> &tags)
+{
+  checkTags(tags);
+  if (!tags.empty() && (unsigned long)id > UINT32_MAX)
+    throw std::runtime_error("Tagged entries need ids below 2^32");
+  uint8_t code = internRole(role);
+  grow(id);
+  if (roles_[id] == NO_ENTRY)
+    ++count_;
+  putTimestamp(id, timestamp);
+  putRole(id, code);
+  content_offsets_[id] = content.empty() ? 0 : appendBytes(content);
+  content_lengths_[id] = content.size();
+  putTags(id, tags);
+  for (std::string_view tag : tags)
+    tag_index_.bitmap(tag).add(id);
+  putJson(id, tags);
+}
+
+// Ids come from a counter, so a file never skips far past the entries it holds;
+// this bounds how much a corrupt id can make grow() allocate
+static constexpr long MAX_ID_GAP = 1 << 24;
+
+void EntryStore::validate(const MetadataStore &store) const
+{
+  for (uint32_t code = 0; code < store.roleCount(); ++code)
+  {
+    if (!store.roleValid(code))
+      throw std::runtime_error("Metadata file has an invalid role");
+  }
+  for (uint32_t code = 0; code < store.tagCount(); ++code)
+  {
+    if (!store.tagValid(code) || store.tag(code).empty())
+      throw std::runtime_error("Metadata file has an invalid tag");
+  }
+  long max_id = endId() + (long)store.size() + MAX_ID_GAP;
+  for (size_t i = 0; i < store.size(); ++i)
+  {
+    const MetadataRecord &r = store.record(i);
+    if (r.id < 0 || r.id >= max_id)
+      throw std::runtime_error("Metadata record has an invalid id");
+    if (r.role >= store.roleCount() || !store.inHeap(r.content_offset, r.content_length))
+      throw std::runtime_error("Metadata record has an invalid role or content");
+    auto [codes, count] = store.tagLinks(i);
+    for (uint32_t t = 0; t < count; ++t)
+    {
+      if (codes[t] >= store.tagCount() || (unsigned long)r.id > UINT32_MAX)
+        throw std::runtime_error("Metadata record has an invalid tag");
+    }
+  }
+}
+
+void EntryStore::load(const MetadataStore &store)
+{
+  if (store.size() == 0)
+    return;
+  // Nothing is changed unless every record is valid
+  validate(store);
+
+  // Role codes are per file; translate them once
+  std::vector<uint8_t> role_map;
+  for (uint32_t code = 0; code < store.roleCount(); ++code)
+    role_map.push_back(internRole(store.role(code)));
+
+  // Copy the whole heap as one chunk when offsets fit the 32-bit in-chunk offset
+  bool adopt = store.heapSize() <= 0xFFFFFFFFu;
+  uint64_t chunk = 0;
+  if (adopt && store.heapSize() > 0)
+  {
+    chunks_.emplace_back(new char[store.heapSize()]);
+    std::memcpy(chunks_.back().get(), store.heap(), store.heapSize());
+    arena_bytes_ += store.heapSize();
+    chunk = chunks_.size() - 1;
+  }
+
+  // Tag codes are per file too; resolve each to its bitmap once
+  std::vector<std::string_view> tag_names;
+  std::vector<TagBitmap *> tag_bitmaps;
+  for (uint32_t code = 0; code < store.tagCount(); ++code)
+  {
+    tag_names.push_back(store.tag(code));
+    tag_bitmaps.push_back(&tag_index_.bitmap(tag_names.back()));
+  }
+
+  long max_id = 0;
+  for (size_t i = 0; i < store.size(); ++i)
+    max_id = std::max<long>(max_id, store.record(i).id);
+  grow(max_id);
+  // Reused across records so the loop allocates nothing per entry
+  std::vector<std::string_view> tags;
+  for (size_t i = 0; i < store.size(); ++i)
+  {
+    const MetadataRecord &r = store.record(i);
+    if (roles_[r.id] == NO_ENTRY)
+      ++count_;
+    putTimestamp(r.id, r.timestamp);
+    putRole(r.id, role_map[r.role]);
+    content_lengths_[r.id] = r.content_length;
+    if (r.content_length == 0)
+      content_offsets_[r.id] = 0;
+    else if (adopt)
+      content_offsets_[r.id] = (chunk << 32) | r.content_offset;
+    else
+      content_offsets_[r.id] = appendBytes(store.content(r));
+
+    tags.clear();
+    auto [codes, count] = store.tagLinks(i);
+    for (uint32_t t = 0; t < count; ++t)
+    {
+      tags.push_back(tag_names[codes[t]]);
+      tag_bitmaps[codes[t]]->add(r.id);
+    }
+    putTags(r.id, tags);
+    putJson(r.id, tags);
+  }
+}
+
+void EntryStore::clear()
+{
+  timestamps_.clear();
+  roles_.clear();
+  content_offsets_.clear();
+  content_lengths_.clear();
+  json_offsets_.clear();
+  json_lengths_.clear();
+  tag_offsets_.clear();
+  tag_lengths_.clear();
+  tag_index_.clear();
+  for (TagBitmap &ids : role_ids_)
+    ids = TagBitmap();
+  role_ids_complete_ = true;
+  count_ = 0;
+  timestamps_sorted_ = true;
+  chunks_.clear();
+  current_chunk_ = 0;
+  chunk_used_ = CHUNK_SIZE;
+  arena_bytes_ = 0;
+}
+
+size_t EntryStore::roleIdsUsage() const
+{
+  size_t bytes = 0;
+  for (size_t code = 0; code < role_count_.load(std::memory_order_acquire); ++code)
+    bytes += role_ids_[code].memoryUsage();
+  return bytes;
+}
+
+size_t EntryStore::memoryUsage() const
+{
+  return timestamps_.capacity() * sizeof(int64_t) + roles_.capacity() * sizeof(uint8_t) +
+         content_offsets_.capacity() * sizeof(uint64_t) + content_lengths_.capacity() * sizeof(uint32_t) +
+         json_offsets_.capacity() * sizeof(uint64_t) + json_lengths_.capacity() * sizeof(uint32_t) +
+         tag_offsets_.capacity() * sizeof(uint64_t) + tag_lengths_.capacity() * sizeof(uint32_t) +
+         tag_index_.memoryUsage() + roleIdsUsage() + arena_bytes_;
+}
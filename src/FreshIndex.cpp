@@ -0,0 +1,65 @@
+#include "FreshIndex.hpp"
+#include <algorithm>
+
+FreshIndex::FreshIndex(size_t dimension, size_t capacity)
+    : capacity_(capacity), space_(dimension)
+{
+  clear();
+}
+
+bool FreshIndex::add(const float *vector, long id)
+{
+  if (!enabled())
+    return false;
+  if (ids_.size() == capacity_)
+  {
+    if (indexed_ == 0)
+      return false;
+    vectors_->removePoint(ids_.front());
+    ids_.pop_front();
+    --indexed_;
+  }
+  vectors_->addPoint(vector, id);
+  ids_.push_back(id);
+  return true;
+}
+
+const float *FreshIndex::find(long id) const
+{
+  if (!enabled())
+    return nullptr;
+  auto found = vectors_->dict_external_to_internal.find(id);
+  if (found == vectors_->dict_external_to_internal.end())
+    return nullptr;
+  return (const float *)(vectors_->data_ + vectors_->size_per_element_ * found->second);
+}
+
+std::vector<std::pair<float, hnswlib::labeltype>> FreshIndex::search(const float *query, size_t k,
+                                                                     hnswlib::BaseFilterFunctor *filter) const
+{
+  std::vector<std::pair<float, hnswlib::labeltype>> ranked;
+  k = std::min(k, ids_.size());
+  if (k == 0)
+    return ranked;
+  auto top = vectors_->searchKnn(query, k, filter);
+  while (!top.empty())
+  {
+    ranked.push_back(top.top());
+    top.pop();
+  }
+  std::reverse(ranked.begin(), ranked.end());
+  return ranked;
+}
+
+void FreshIndex::clear()
+{
+  if (enabled())
+    vectors_ = std::make_unique<hnswlib::BruteforceSearch<float>>(&space_, capacity_);
+  ids_.clear();
+  indexed_ = 0;
+}
+
+size_t FreshIndex::memoryUsage() const
+{
+  return enabled() ? capacity_ * vectors_->size_per_element_ + ids_.size() * (sizeof(long) + 32) : 0;
+}
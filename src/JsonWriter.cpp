@@ -0,0 +1,184 @@
+#include "JsonWriter.hpp"
+#include <nlohmann/json.hpp>
+#include <cstdio>
+#include <ctime>
+
+// Timestamps are kept as epoch seconds and rendered as ISO-8601 strings in responses
+int64_t parseTimestamp(const std::string &ts)
+{
+  std::tm tm{};
+  if (sscanf(ts.c_str(), "%d-%d-%dT%d:%d:%dZ", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+             &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+    return 0;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  return timegm(&tm);
+}
+
+// Formats into a stack buffer so appending needs no temporary string
+static size_t writeTimestamp(char (&buf)[30], int64_t epoch)
+{
+  std::time_t t = epoch;
+  std::tm tm{};
+  gmtime_r(&t, &tm);
+  return std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+std::string formatTimestamp(int64_t epoch)
+{
+  char buf[30];
+  return std::string(buf, writeTimestamp(buf, epoch));
+}
+
+// Length of the well-formed UTF-8 sequence starting at s[i], or 0 if there is
+// none; prefix is then how many of its bytes were well-formed (at least 1)
+static size_t utf8Sequence(std::string_view s, size_t i, size_t &prefix)
+{
+  unsigned char c = s[i];
+  unsigned char lo = 0x80, hi = 0xBF; // range of the second byte; later ones are 80-BF
+  size_t length;
+  if (c >= 0xC2 && c <= 0xDF)
+    length = 2;
+  else if (c >= 0xE0 && c <= 0xEF)
+  {
+    length = 3;
+    if (c == 0xE0)
+      lo = 0xA0; // overlong
+    else if (c == 0xED)
+      hi = 0x9F; // surrogates
+  }
+  else if (c >= 0xF0 && c <= 0xF4)
+  {
+    length = 4;
+    if (c == 0xF0)
+      lo = 0x90; // overlong
+    else if (c == 0xF4)
+      hi = 0x8F; // above U+10FFFF
+  }
+  else
+  {
+    prefix = 1;
+    return 0;
+  }
+  for (size_t k = 1; k < length; ++k)
+  {
+    if (i + k == s.size() || (unsigned char)s[i + k] < lo || (unsigned char)s[i + k] > hi)
+    {
+      prefix = k;
+      return 0;
+    }
+    lo = 0x80;
+    hi = 0xBF;
+  }
+  return length;
+}
+
+void appendJsonString(std::string &out, std::string_view s)
+{
+  static const char HEX[] = "0123456789abcdef";
+  out.push_back('"');
+  size_t run = 0; // start of the pending run of bytes that need no escaping
+  for (size_t i = 0; i < s.size(); ++i)
+  {
+    unsigned char c = s[i];
+    if (c >= 0x80)
+    {
+      size_t prefix;
+      if (size_t length = utf8Sequence(s, i, prefix))
+      {
+        i += length - 1;
+        continue;
+      }
+      // As dump() with error_handler_t::replace: the well-formed start of a broken
+      // sequence becomes one U+FFFD and the byte that broke it is read again
+      out.append(s.data() + run, i - run);
+      out += "\xEF\xBF\xBD";
+      i += prefix - 1;
+      run = i + 1;
+      continue;
+    }
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(s.data() + run, i - run);
+    run = i + 1;
+    switch (c)
+    {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\b':
+      out += "\\b";
+      break;
+    case '\f':
+      out += "\\f";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      out += "\\u00";
+      out.push_back(HEX[c >> 4]);
+      out.push_back(HEX[c & 0xF]);
+    }
+  }
+  out.append(s.data() + run, s.size() - run);
+  out.push_back('"');
+}
+
+void appendEntryJson(std::string &out, long id, int64_t timestamp, std::string_view role,
+                     std::string_view content, const std::vector<std::string_view> &tags)
+{
+  out.reserve(out.size() + content.size() + role.size() + 80);
+  out += "{\"content\":";
+  appendJsonString(out, content);
+  out += ",\"id\":";
+  out += std::to_string(id);
+  out += ",\"role\":";
+  appendJsonString(out, role);
+  if (!tags.empty())
+  {
+    out += ",\"tags\":[";
+    for (size_t i = 0; i < tags.size(); ++i)
+    {
+      if (i)
+        out.push_back(',');
+      appendJsonString(out, tags[i]);
+    }
+    out.push_back(']');
+  }
+  out += ",\"timestamp\":\"";
+  char buf[30];
+  out.append(buf, writeTimestamp(buf, timestamp));
+  out += "\"}";
+}
+
+std::string joinJsonArray(const std::vector<std::string_view> &fragments, bool pretty)
+{
+  size_t total = 2 + (fragments.empty() ? 0 : fragments.size() - 1);
+  for (auto fragment : fragments)
+    total += fragment.size();
+
+  std::string out;
+  out.reserve(total);
+  out.push_back('[');
+  for (size_t i = 0; i < fragments.size(); ++i)
+  {
+    if (i)
+      out.push_back(',');
+    out.append(fragments[i]);
+  }
+  out.push_back(']');
+
+  if (pretty)
+    return nlohmann::json::parse(out).dump(2);
+  return out;
+}
@@ -0,0 +1,97 @@
+#include "LocalProtocol.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+static uint32_t readU32(std::string_view s, size_t offset)
+{
+  uint32_t v;
+  std::memcpy(&v, s.data() + offset, sizeof(v));
+  return v;
+}
+
+static LocalStatus dispatch(MemoryManager &memory, std::string_view request, std::string &body)
+{
+  uint8_t op = request[0];
+  size_t size = request.size();
+  auto reject = [&body](LocalStatus status, const char *message)
+  {
+    body = message;
+    return status;
+  };
+
+  if (op == OP_RECENT)
+  {
+    if (!memory.isMetadataReady())
+      return reject(STATUS_STARTING_UP, "Server is starting up");
+    if (size != 5)
+      return reject(STATUS_BAD_REQUEST, "RECENT takes a uint32 count");
+    uint32_t n = readU32(request, 1);
+    body = memory.getLastNJson(n == 0xFFFFFFFFu ? memory.getShortTermSize() : std::min<uint32_t>(n, INT32_MAX));
+    return STATUS_OK;
+  }
+
+  if (!memory.isSearchReady())
+    return reject(STATUS_STARTING_UP, "Server is starting up");
+
+  switch (op)
+  {
+  case OP_ADD:
+  {
+    if (size < 5 || readU32(request, 1) > size - 5)
+      return reject(STATUS_BAD_REQUEST, "ADD takes a role length, role and content");
+    uint32_t role_length = readU32(request, 1);
+    memory.add(std::string(request.substr(5, role_length)), std::string(request.substr(5 + role_length)));
+    return STATUS_OK;
+  }
+  case OP_SEMANTIC:
+  case OP_VECTOR:
+  {
+    if (size < 5 || readU32(request, 1) < 1 || readU32(request, 1) > INT32_MAX)
+      return reject(STATUS_BAD_REQUEST, "Search takes a positive uint32 k");
+    int k = readU32(request, 1);
+    if (op == OP_SEMANTIC)
+    {
+      body = memory.getRelevantMemoriesJson(std::string(request.substr(5)), k);
+      return STATUS_OK;
+    }
+    std::vector<float> vector((size - 5) / sizeof(float));
+    if (vector.size() != (size_t)memory.getDimension() || (size - 5) % sizeof(float) != 0)
+      return reject(STATUS_BAD_REQUEST, "Vector has the wrong dimension");
+    std::memcpy(vector.data(), request.data() + 5, size - 5);
+    body = memory.getRelevantMemoriesByVectorJson(std::move(vector), k);
+    return STATUS_OK;
+  }
+  case OP_EMBED:
+  {
+    if (size < 2 || (uint8_t)request[1] > 1)
+      return reject(STATUS_BAD_REQUEST, "EMBED takes a type byte and text");
+    std::vector<float> embedding = memory.embed(std::string(request.substr(2)), request[1] == 0 ? TaskType::Query : TaskType::Document);
+    body.assign(reinterpret_cast<const char *>(embedding.data()), embedding.size() * sizeof(float));
+    return STATUS_OK;
+  }
+  default:
+    return reject(STATUS_BAD_REQUEST, "Unknown opcode");
+  }
+}
+
+LocalStatus handleLocalRequest(MemoryManager &memory, std::string_view request, std::string &body)
+{
+  body.clear();
+  if (request.empty())
+  {
+    body = "Empty request";
+    return STATUS_BAD_REQUEST;
+  }
+  try
+  {
+    return dispatch(memory, request, body);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error in local request: " << e.what() << std::endl;
+    body = e.what();
+    return STATUS_ERROR;
+  }
+}
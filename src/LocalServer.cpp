@@ -0,0 +1,170 @@
+#include "LocalServer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool readFull(int fd, void *buf, size_t size)
+{
+  char *p = static_cast<char *>(buf);
+  while (size > 0)
+  {
+    ssize_t n = ::recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool writeFull(int fd, const void *buf, size_t size)
+{
+  const char *p = static_cast<const char *>(buf);
+  while (size > 0)
+  {
+    ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+LocalServer::LocalServer(MemoryManager &memory, const std::string &socket_path)
+    : memory_(memory), socket_path_(socket_path)
+{
+}
+
+LocalServer::~LocalServer()
+{
+  stop();
+}
+
+void LocalServer::start()
+{
+  sockaddr_un addr{};
+  if (socket_path_.size() >= sizeof(addr.sun_path))
+    throw std::runtime_error("Socket path too long: " + socket_path_);
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, socket_path_.c_str(), sizeof(addr.sun_path) - 1);
+
+  listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0)
+    throw std::runtime_error("Cannot create Unix socket");
+
+  struct stat st;
+  if (::lstat(socket_path_.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    ::unlink(socket_path_.c_str()); // stale socket from a previous run
+  // bind() creates the socket file with the umask applied; adding 0077 to it keeps
+  // the file private to the owner until the chmod opens it to the group. The umask
+  // is process-wide, but it only gets stricter meanwhile.
+  mode_t saved_umask = ::umask(0077);
+  ::umask(saved_umask | 0077);
+  bool bound = ::bind(listen_fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0;
+  int bind_errno = errno;
+  ::umask(saved_umask);
+  errno = bind_errno;
+  if (!bound || ::chmod(socket_path_.c_str(), 0660) != 0 || ::listen(listen_fd_, 64) != 0)
+  {
+    std::string error = std::strerror(errno);
+    ::close(listen_fd_);
+    listen_fd_ = -1;
+    throw std::runtime_error("Cannot listen on " + socket_path_ + ": " + error);
+  }
+
+  accept_thread_ = std::thread([this]()
+                               { acceptLoop(); });
+  std::cout << "Listening on unix:" << socket_path_ << std::endl;
+}
+
+void LocalServer::stop()
+{
+  if (stopping_.exchange(true))
+    return;
+  if (listen_fd_ >= 0)
+    ::shutdown(listen_fd_, SHUT_RDWR);
+  if (accept_thread_.joinable())
+    accept_thread_.join();
+  if (listen_fd_ >= 0)
+  {
+    ::close(listen_fd_);
+    ::unlink(socket_path_.c_str());
+    listen_fd_ = -1;
+  }
+
+  std::unique_lock<std::mutex> lock(clients_mtx_);
+  for (int fd : client_fds_)
+    ::shutdown(fd, SHUT_RDWR);
+  clients_cv_.wait(lock, [this]
+                   { return client_fds_.empty(); });
+}
+
+void LocalServer::acceptLoop()
+{
+  while (!stopping_)
+  {
+    int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (!stopping_)
+        std::cerr << "Unix socket accept failed: " << std::strerror(errno) << std::endl;
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(clients_mtx_);
+    if (stopping_)
+    {
+      ::close(fd);
+      return;
+    }
+    client_fds_.push_back(fd);
+    std::thread([this, fd]()
+                { serve(fd); })
+        .detach();
+  }
+}
+
+// One thread per connection; local clients keep a handful of long-lived connections
+void LocalServer::serve(int fd)
+{
+  std::string request;
+  std::string response;
+  while (!stopping_)
+  {
+    uint32_t length;
+    if (!readFull(fd, &length, sizeof(length)) || length == 0 || length > MAX_FRAME_SIZE)
+      break;
+    request.resize(length);
+    if (!readFull(fd, &request[0], length))
+      break;
+
+    std::string body;
+    LocalStatus status = handleLocalRequest(memory_, request, body);
+
+    uint32_t out_length = body.size() + 1;
+    response.resize(sizeof(out_length) + out_length);
+    std::memcpy(&response[0], &out_length, sizeof(out_length));
+    response[sizeof(out_length)] = (char)status;
+    std::memcpy(&response[sizeof(out_length) + 1], body.data(), body.size());
+    if (!writeFull(fd, response.data(), response.size()))
+      break;
+  }
+
+  std::lock_guard<std::mutex> lock(clients_mtx_);
+  client_fds_.erase(std::remove(client_fds_.begin(), client_fds_.end(), fd), client_fds_.end());
+  ::close(fd);
+  clients_cv_.notify_all();
+}
@@ -1,4 +1,5 @@
 #include "MemoryManager.hpp"
+#include "MetadataStore.hpp"
 #include "hnswlib/hnswlib.h" // Added for hnswlib cosine similarity
 #include <sstream>
 #include <iostream>
@@ -17,17 +18,22 @@ void to_json(json &j, const MemoryEntry &m)
 {
   j = json{
       {"id", m.id},
-      {"timestamp", m.timestamp},
+      {"timestamp", formatTimestamp(m.timestamp)},
       {"role", m.role},
       {"content", m.content}};
+  if (!m.tags.empty())
+    j["tags"] = m.tags;
 }
 
 void from_json(const json &j, MemoryEntry &m)
 {
   j.at("id").get_to(m.id);
-  j.at("timestamp").get_to(m.timestamp);
+  m.timestamp = parseTimestamp(j.at("timestamp").get<std::string>());
   j.at("role").get_to(m.role);
   j.at("content").get_to(m.content);
+  m.tags.clear();
+  if (j.contains("tags"))
+    j["tags"].get_to(m.tags);
 }
 
 // Utility: Normalize vector to unit length (required for cosine similarity)
@@ -44,169 +50,1088 @@ static void normalizeVector(std::vector<float> &vec)
   }
 }
 
-std::string MemoryManager::currentTimestamp() const
+int64_t MemoryManager::currentTimestamp() const
 {
   auto now = std::chrono::system_clock::now();
-  std::time_t t = std::chrono::system_clock::to_time_t(now);
-  std::tm tm = *std::gmtime(&t);
-  char buf[30];
-  std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
-  return buf;
+  return std::chrono::system_clock::to_time_t(now);
 }
 
-size_t MemoryManager::getShortTermSize() const
+MemoryView MemoryManager::viewAt(long id) const
 {
-  return short_term_ids_.size();
+  return MemoryView{id, entries_.timestamp(id), entries_.role(id), entries_.content(id), entries_.json(id),
+                    entries_.packedTags(id)};
 }
 
-MemoryManager::MemoryManager(const std::string &model_path, int dimension)
-    : model_path_(model_path), dimension_(dimension)
+static MemoryEntry toEntry(const MemoryView &view)
 {
-  embedding_generator_ = std::make_unique<LlamaEmbeddingGenerator>(model_path_, 512);
+  MemoryEntry entry{view.id, view.timestamp, std::string(view.role), std::string(view.content), {}};
+  for (std::string_view tag : EntryStore::unpackTags(view.tags))
+    entry.tags.emplace_back(tag);
+  return entry;
+}
+
+MemoryEntry MemoryManager::entryAt(long id) const
+{
+  return toEntry(viewAt(id));
+}
+
+size_t MemoryManager::getShortTermSize(const std::string &session) const
+{
+  return session.empty() ? short_term_.size() : sessions_.size(session);
+}
+
+bool MemoryManager::isMetadataReady() const
+{
+  return metadata_ready_;
+}
+
+bool MemoryManager::isSearchReady() const
+{
+  return search_ready_;
+}
+
+void MemoryManager::waitForMetadata()
+{
+  if (metadata_ready_.load(std::memory_order_acquire))
+    return;
+  std::unique_lock<std::mutex> lock(ready_mtx_);
+  ready_cv_.wait(lock, [this]
+                 { return metadata_ready_.load(); });
+}
+
+void MemoryManager::waitForIndex()
+{
+  std::unique_lock<std::mutex> lock(ready_mtx_);
+  ready_cv_.wait(lock, [this]
+                 { return index_loaded_; });
+}
+
+void MemoryManager::waitForSearch()
+{
+  std::unique_lock<std::mutex> lock(ready_mtx_);
+  ready_cv_.wait(lock, [this]
+                 { return startup_done_; });
+  if (!search_ready_)
+    throw std::runtime_error("Embedding model failed to load");
+}
+
+static long elapsedMs(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+MemoryManager::MemoryManager(const std::string &model_path, const MemoryConfig &config)
+    : MemoryManager(model_path, SharedModel(), config)
+{
+}
+
+MemoryManager::MemoryManager(SharedModel model, const MemoryConfig &config)
+    : MemoryManager(std::string(), std::move(model), config)
+{
+}
 
+// Returns immediately; the model, index and metadata are loaded by startup()
+MemoryManager::MemoryManager(const std::string &model_path, SharedModel model, const MemoryConfig &config)
+    : model_path_(model_path), config_(config), dimension_(config.dimension), shared_model_(std::move(model)),
+      space_(new hnswlib::InnerProductSpace(config.dimension)), index_(space_, config.max_elements),
+      fresh_(config.dimension, config.fresh_capacity), short_term_(config.short_term_capacity),
+      sessions_(config.short_term_capacity, config.max_sessions, config.session_idle_seconds), result_cache_(config.result_cache_size),
+      similar_queries_(config.dimension, config.query_cache_size, config.query_cache_epsilon)
+{
   // HNSWlib initialization for cosine similarity
-  max_elements_ = 20000; // Adjust to your expected dataset size
-  space_ = new hnswlib::InnerProductSpace(dimension_);
-  index_ = new hnswlib::HierarchicalNSW<float>(space_, max_elements_, 32, 400); // M=16, efConstruction=400
+  max_elements_ = config_.max_elements; // Adjust to your expected dataset size
+  std::filesystem::create_directories(config_.data_dir);
+  index_.reset(config_.index_shards, HNSW_M, HNSW_EF_CONSTRUCTION);
+
+  startup_thread_ = std::thread([this]()
+                                { startup(); });
+}
+
+// Loads the model in parallel with the index and metadata. Recent-memory reads
+// are served once metadata is in; semantic search and adds wait for the model too.
+void MemoryManager::startup()
+{
+  auto start = std::chrono::steady_clock::now();
+  std::thread model_thread([this, start]()
+                           {
+    try {
+      if (shared_model_.valid()) {
+        embedding_generator_ = shared_model_.get();
+        if (!embedding_generator_)
+          throw std::runtime_error("shared model failed to load");
+      } else {
+        embedding_generator_ = std::make_shared<LlamaEmbeddingGenerator>(model_path_, 512);
+      }
+    } catch (const std::exception &e) {
+      std::cerr << "Error loading embedding model: " << e.what() << std::endl;
+      startup_failed_ = true;
+    }
+    timings_.model_ms = elapsedMs(start); });
+
+  // Recent-memory reads only need the metadata, so they are let in while the index
+  // is still loading
+  auto metadata_loaded = [this, start]()
+  {
+    timings_.metadata_ready_ms = elapsedMs(start);
+    {
+      std::lock_guard<std::mutex> lock(ready_mtx_);
+      metadata_ready_ = true;
+    }
+    ready_cv_.notify_all();
+  };
+  loadFromDisk(metadata_loaded);
+  if (!metadata_ready_)
+    metadata_loaded();
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    refreshUsage();
+  }
+  {
+    std::lock_guard<std::mutex> lock(ready_mtx_);
+    index_loaded_ = true;
+  }
+  ready_cv_.notify_all();
 
-  loadFromDisk();
+  model_thread.join();
+  timings_.search_ready_ms = elapsedMs(start);
+  {
+    std::lock_guard<std::mutex> lock(ready_mtx_);
+    search_ready_ = !startup_failed_;
+    startup_done_ = true;
+  }
+  ready_cv_.notify_all();
 
-  // Background save thread for persistence (unchanged)
+  std::cout << "Startup: model " << timings_.model_ms << " ms, index " << timings_.index_ms
+            << " ms, metadata " << timings_.metadata_ms << " ms (parallel); recent ready at "
+            << timings_.metadata_ready_ms << " ms, search ready at " << timings_.search_ready_ms
+            << " ms." << std::endl;
+
+  // Background save thread: writes delta checkpoints and folds them into a new
+  // base generation once enough have accumulated (the merge runs without mtx_)
   saver_thread_ = std::thread([this]()
                               {
         while (!stop_saving_) {
-            std::this_thread::sleep_for(std::chrono::seconds(10));
+            {
+                // Woken early by the destructor, so closing a store does not wait out the interval
+                std::unique_lock<std::mutex> lock(stop_mtx_);
+                if (stop_cv_.wait_for(lock, std::chrono::seconds(10), [this] { return stop_saving_.load(); }))
+                    break;
+            }
             if (dirty_) {
-                std::lock_guard<std::mutex> lock(mtx_);
-                saveToDisk();
-                dirty_ = false;
+                std::unique_lock<std::mutex> lock(mtx_);
+                if (checkpoint(lock))
+                    dirty_ = false;
+                refreshUsage();
             }
+            if (has_manifest_ && manifest_.current.deltas.size() >= config_.merge_after_deltas)
+                mergeDeltas();
+            sessions_.evictIdle(currentTimestamp());
         } });
+
+  if (fresh_.enabled())
+  {
+    indexer_thread_ = std::thread([this]()
+                                  {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (true) {
+            indexer_cv_.wait(lock, [this] { return stop_saving_ || fresh_.pendingCount() > 0; });
+            if (stop_saving_)
+                break;
+            indexPending(lock, INDEX_BATCH);
+            // Let adds and searches in between batches
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        } });
+  }
+}
+
+// A vector the graph rejects (it is full) is logged and dropped from the queue, as
+// add() does; it stays searchable until it leaves fresh_. The vectors are copied out
+// of fresh_ and inserted with mtx_ released, since hnswlib locks each element it
+// links and searches may walk the graph meanwhile; mtx_ is taken again only to move
+// the watermark. fresh_ keeps pending vectors, so they stay searchable throughout.
+void MemoryManager::indexPending(std::unique_lock<std::mutex> &lock, size_t max)
+{
+  // One batch at a time, so the watermark only moves over the vectors inserted
+  indexed_cv_.wait(lock, [this]
+                   { return !indexing_; });
+  size_t n = std::min(max, fresh_.pendingCount());
+  if (n == 0)
+    return;
+  std::vector<float> vectors(n * dimension_);
+  std::vector<std::pair<long, const float *>> points;
+  points.reserve(n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    long id = fresh_.pendingId(i);
+    float *copy = vectors.data() + i * dimension_;
+    std::copy_n(fresh_.find(id), dimension_, copy);
+    points.emplace_back(id, copy);
+  }
+  indexing_ = true;
+  lock.unlock();
+  try
+  {
+    index_.addPoints(points);
+  }
+  catch (...)
+  {
+    lock.lock();
+    indexing_ = false;
+    indexed_cv_.notify_all();
+    throw;
+  }
+  lock.lock();
+  fresh_.markIndexed(n);
+  indexing_ = false;
+  indexed_cv_.notify_all();
+}
+
+const float *MemoryManager::vectorOf(long id) const
+{
+  if (const float *vector = index_.find(id))
+    return vector;
+  return fresh_.find(id);
 }
 
 MemoryManager::~MemoryManager()
 {
-  stop_saving_ = true;
+  {
+    std::lock_guard<std::mutex> lock(stop_mtx_);
+    stop_saving_ = true;
+  }
+  stop_cv_.notify_all();
+  if (startup_thread_.joinable())
+    startup_thread_.join();
   if (saver_thread_.joinable())
     saver_thread_.join();
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+  }
+  indexer_cv_.notify_all();
+  if (indexer_thread_.joinable())
+    indexer_thread_.join();
 
-  std::lock_guard<std::mutex> lock(mtx_);
+  std::unique_lock<std::mutex> lock(mtx_);
   if (dirty_)
-    saveToDisk();
+    checkpoint(lock);
 
-  // Clean up hnswlib objects
-  delete index_;
+  // Clean up hnswlib objects; the shards do not use the space once searches are over
   delete space_;
 }
 
 // Add entry and embedding to memory and index
-void MemoryManager::add(const std::string &role, const std::string &content)
+// Estimated growth of memoryUsage() for one add: its arena bytes, its slots in
+// the columns, and its vector with graph links and a label lookup node
+static size_t addedBytes(size_t arena_bytes, size_t dimension)
 {
-  std::lock_guard<std::mutex> lock(mtx_);
-
-  long current_id = next_id_++;
-  MemoryEntry new_entry = {current_id, currentTimestamp(), role, content};
-  memory_data_[current_id] = new_entry;
+  return arena_bytes + 64 + dimension * sizeof(float) + 192;
+}
 
-  short_term_ids_.push_back(current_id);
-  if (short_term_ids_.size() > 50)
-  {
-    short_term_ids_.pop_front();
-  }
+void MemoryManager::add(const std::string &role, const std::string &content, const std::vector<std::string> &tags,
+                        const std::string &session)
+{
+  waitForSearch();
+  std::lock_guard<std::mutex> lock(mtx_);
+  long id = putEntry(role, content, tags, session);
 
   try
   {
     // Use TaskType::Document when creating a memory's embedding
     std::vector<float> embedding = generateEmbedding(content, TaskType::Document); // <-- CHANGE HERE
-
-    if (!embedding.empty())
-    {
-      normalizeVector(embedding); // Normalize embedding for cosine similarity
-      index_->addPoint(embedding.data(), current_id);
-    }
+    putVector(id, embedding);
   }
   catch (const std::runtime_error &e)
   {
     std::cerr << "Error generating embedding: " << e.what() << std::endl;
   }
+  dirty_ = true;
+}
 
+void MemoryManager::addBatch(const std::vector<MemoryInput> &inputs, const std::string &session)
+{
+  waitForSearch();
+  if (inputs.empty())
+    return;
+  // Checked before the embedding is paid for, and again under mtx_ since roles
+  // may have been interned meanwhile
+  checkInputs(inputs);
+  std::vector<std::string> contents;
+  contents.reserve(inputs.size());
+  for (const MemoryInput &input : inputs)
+    contents.push_back(input.content);
+  std::vector<std::vector<float>> embeddings = generateEmbeddings(contents, TaskType::Document);
+  if (embeddings.size() != inputs.size())
+    throw std::runtime_error("Embedding model returned the wrong number of embeddings");
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  checkInputs(inputs);
+  for (size_t i = 0; i < inputs.size(); ++i)
+  {
+    long id = putEntry(inputs[i].role, inputs[i].content, inputs[i].tags, session);
+    try
+    {
+      putVector(id, embeddings[i]);
+    }
+    catch (const std::runtime_error &e)
+    {
+      // As in add(): the entry stays, without a vector
+      std::cerr << "Error indexing entry " << id << ": " << e.what() << std::endl;
+    }
+  }
   dirty_ = true;
 }
 
-std::vector<float> MemoryManager::generateEmbedding(const std::string &text, TaskType type) const
+void MemoryManager::checkInputs(const std::vector<MemoryInput> &inputs) const
 {
-  std::string prefix;
-  if (type == TaskType::Query)
+  size_t new_roles = 0;
+  std::vector<std::string_view> seen;
+  bool tagged = false;
+  for (const MemoryInput &input : inputs)
   {
-    prefix = "search_query: ";
+    EntryStore::checkTags(std::vector<std::string_view>(input.tags.begin(), input.tags.end()));
+    tagged = tagged || !input.tags.empty();
+    if (entries_.findRole(input.role) == EntryStore::NO_ENTRY &&
+        std::find(seen.begin(), seen.end(), input.role) == seen.end())
+    {
+      seen.push_back(input.role);
+      ++new_roles;
+    }
   }
+  if (entries_.roleCount() + new_roles > EntryStore::MAX_ROLES)
+    throw std::runtime_error("Too many distinct roles");
+  if (tagged && (unsigned long)(next_id_ + inputs.size()) > UINT32_MAX)
+    throw std::runtime_error("Tagged entries need ids below 2^32");
+}
+
+long MemoryManager::putEntry(const std::string &role, const std::string &content, const std::vector<std::string> &tags,
+                             const std::string &session)
+{
+  long current_id = next_id_;
+  // Timestamps never decrease with ids, even if the clock steps back, so the
+  // timestamp column stays sorted for time-range lookups
+  int64_t timestamp = currentTimestamp();
+  if (current_id > 0 && entries_.contains(current_id - 1))
+    timestamp = std::max(timestamp, entries_.timestamp(current_id - 1));
+  // Throws on an invalid role or tag before anything is stored
+  entries_.put(current_id, timestamp, role, content, std::vector<std::string_view>(tags.begin(), tags.end()));
+  ++next_id_;
+  std::string_view fragment = entries_.json(current_id);
+  std::string_view packed_tags = entries_.packedTags(current_id);
+  RecentEntry recent{current_id, timestamp, entries_.roleCode(current_id),
+                     entries_.contentData(current_id), (uint32_t)content.size(),
+                     fragment.data(), (uint32_t)fragment.size(),
+                     packed_tags.data(), (uint32_t)packed_tags.size()};
+  short_term_.push(recent);
+  if (!session.empty())
+    sessions_.push(session, recent, timestamp);
+  usage_.fetch_add(addedBytes(content.size() + fragment.size() + packed_tags.size(), dimension_),
+                   std::memory_order_relaxed);
+  return current_id;
+}
+
+void MemoryManager::putVector(long id, std::vector<float> &embedding)
+{
+  if (embedding.empty())
+    return;
+  normalizeVector(embedding); // Normalize embedding for cosine similarity
+  // The graph insert is left to the indexer thread unless it has fallen a whole buffer behind
+  if (fresh_.add(embedding.data(), id))
+    indexer_cv_.notify_one();
   else
+    index_.addPoint(embedding.data(), id);
+}
+
+static const char *taskPrefix(TaskType type)
+{
+  return type == TaskType::Query ? "search_query: " : "search_document: ";
+}
+
+std::vector<float> MemoryManager::generateEmbedding(const std::string &text, TaskType type) const
+{
+  std::string processedText = taskPrefix(type) + text;
+  return embedding_generator_->generateEmbedding(processedText);
+}
+
+std::vector<std::vector<float>> MemoryManager::generateEmbeddings(const std::vector<std::string> &texts, TaskType type) const
+{
+  std::vector<std::string> processed;
+  processed.reserve(texts.size());
+  for (const std::string &text : texts)
+    processed.push_back(taskPrefix(type) + text);
+  return embedding_generator_->generateEmbeddings(processed);
+}
+
+std::vector<MemoryEntry> MemoryManager::getRelevantMemories(const std::string &query, int k, const SearchOptions &options)
+{
+  std::vector<MemoryEntry> results;
+  for (const MemoryView &view : getRelevantMemoryViews(query, k, options))
+    results.push_back(toEntry(view));
+  return results;
+}
+
+std::vector<MemoryView> MemoryManager::getRelevantMemoryViews(const std::string &query, int k, const SearchOptions &options)
+{
+  waitForSearch();
+  // Identical concurrent queries share one embedding and one graph walk
+  std::string key = query;
+  key.push_back('\0');
+  key += searchParams(k, options);
+  return search_flights_.run(key, [&]()
+                             { return searchText(key, query, k, options); });
+}
+
+// Views point into the entry arena, so the array is joined without holding mtx_
+static std::string joinViews(const std::vector<MemoryView> &views, bool pretty)
+{
+  std::vector<std::string_view> fragments;
+  fragments.reserve(views.size());
+  for (const MemoryView &view : views)
+    fragments.push_back(view.json);
+  return joinJsonArray(fragments, pretty);
+}
+
+std::string MemoryManager::getRelevantMemoriesJson(const std::string &query, int k, bool pretty, const SearchOptions &options)
+{
+  return joinViews(getRelevantMemoryViews(query, k, options), pretty);
+}
+
+std::vector<std::vector<MemoryEntry>> MemoryManager::getRelevantMemoriesBatch(const std::vector<std::string> &queries, int k,
+                                                                              const SearchOptions &options)
+{
+  std::vector<std::vector<MemoryEntry>> results;
+  for (const auto &views : getRelevantMemoryViewsBatch(queries, k, options))
   {
-    prefix = "search_document: ";
+    results.emplace_back();
+    for (const MemoryView &view : views)
+      results.back().push_back(toEntry(view));
   }
-  std::string processedText = prefix + text;
-  return embedding_generator_->generateEmbedding(processedText);
+  return results;
 }
 
-// Retrieve relevant memories with cosine similarity using hnswlib
-std::vector<MemoryEntry> MemoryManager::getRelevantMemories(const std::string &query, int k)
+// Same caches as searchText(), but every query missing from the result cache is
+// embedded in one encode call, and the graph searches left after the caches run
+// in parallel under one hold of mtx_. Repeated queries are searched once.
+std::vector<std::vector<MemoryView>> MemoryManager::getRelevantMemoryViewsBatch(const std::vector<std::string> &queries, int k,
+                                                                                const SearchOptions &options)
 {
+  waitForSearch();
+  std::string params = searchParams(k, options);
+  std::vector<QuerySearch> searches(queries.size());
+  std::vector<size_t> first(queries.size()); // the first query with the same key
+  std::unordered_map<std::string, size_t> keys;
+  std::vector<size_t> distinct;
+  std::vector<size_t> to_embed;
+  std::vector<std::string> texts;
+  for (size_t i = 0; i < queries.size(); ++i)
+  {
+    std::string key = queries[i];
+    key.push_back('\0');
+    key += params;
+    auto [found, inserted] = keys.emplace(key, i);
+    first[i] = found->second;
+    if (!inserted || queries[i].empty())
+      continue;
+    QuerySearch &search = searches[i];
+    search.key = std::move(key);
+    search.params = params;
+    findCached(search);
+    distinct.push_back(i);
+    if (!search.cached)
+    {
+      to_embed.push_back(i);
+      texts.push_back(queries[i]);
+    }
+  }
+
+  if (!texts.empty())
+  {
+    try
+    {
+      std::vector<std::vector<float>> embeddings = generateEmbeddings(texts, TaskType::Query);
+      for (size_t j = 0; j < to_embed.size(); ++j)
+      {
+        normalizeVector(embeddings[j]);
+        findSimilar(searches[to_embed[j]], std::move(embeddings[j]));
+      }
+    }
+    catch (const std::runtime_error &e)
+    {
+      std::cerr << "Error during semantic search: " << e.what() << std::endl;
+    }
+  }
+
+  std::vector<std::vector<MemoryView>> results(queries.size());
   std::lock_guard<std::mutex> lock(mtx_);
+  std::vector<bool> from_cache(queries.size());
+  std::vector<size_t> to_search;
+  for (size_t i : distinct)
+  {
+    const QuerySearch &search = searches[i];
+    if (!search.embedding)
+      continue;
+    from_cache[i] = search.cached && cachedSearchHolds(*search.cached, k, options);
+    if (!from_cache[i])
+      to_search.push_back(i);
+  }
+  // The searches only read the store and the index. They run on the index's pool,
+  // whose workers also walk the shards; hnswlib hands each concurrent walk a
+  // visited list from the shard's VisitedListPool and takes it back afterwards.
+  index_.forEach(to_search.size(), [&](size_t j)
+                 {
+    QuerySearch &search = searches[to_search[j]];
+    std::vector<float> vector = *search.embedding;
+    search.hits = searchVector(vector, k, options, queries[to_search[j]]); });
+  for (size_t i : distinct)
+  {
+    if (searches[i].embedding)
+      finishSearch(searches[i], from_cache[i]);
+  }
+
+  for (size_t i = 0; i < queries.size(); ++i)
+  {
+    for (const SearchHit &hit : searches[first[i]].hits)
+      results[i].push_back(viewAt(hit.id));
+  }
+  return results;
+}
+
+std::string MemoryManager::getRelevantMemoriesBatchJson(const std::vector<std::string> &queries, int k, bool pretty,
+                                                        const SearchOptions &options)
+{
+  std::vector<std::string> arrays;
+  for (const auto &views : getRelevantMemoryViewsBatch(queries, k, options))
+    arrays.push_back(joinViews(views, false));
+  return joinJsonArray(std::vector<std::string_view>(arrays.begin(), arrays.end()), pretty);
+}
+
+std::vector<MemoryEntry> MemoryManager::getRelevantMemoriesByVector(std::vector<float> query_vector, int k, const SearchOptions &options)
+{
   std::vector<MemoryEntry> results;
+  for (const MemoryView &view : getRelevantMemoryViewsByVector(std::move(query_vector), k, options))
+    results.push_back(toEntry(view));
+  return results;
+}
+
+std::vector<MemoryView> MemoryManager::getRelevantMemoryViewsByVector(std::vector<float> query_vector, int k, const SearchOptions &options)
+{
+  waitForSearch();
+  std::lock_guard<std::mutex> lock(mtx_);
+  std::vector<MemoryView> results;
+  for (const SearchHit &hit : searchVector(query_vector, k, options, "<vector>"))
+    results.push_back(viewAt(hit.id));
+  return results;
+}
+
+std::string MemoryManager::getRelevantMemoriesByVectorJson(std::vector<float> query_vector, int k, bool pretty, const SearchOptions &options)
+{
+  return joinViews(getRelevantMemoryViewsByVector(std::move(query_vector), k, options), pretty);
+}
+
+std::vector<float> MemoryManager::embed(const std::string &text, TaskType type)
+{
+  waitForSearch();
+  std::vector<float> embedding = generateEmbedding(text, type);
+  normalizeVector(embedding);
+  return embedding;
+}
+
+int MemoryManager::getDimension() const
+{
+  return dimension_;
+}
+
+// Counts the index elements in use rather than its capacity, since untouched
+// pages of the preallocated level-0 array (or of a mapped file) are not resident,
+// plus the per-capacity lock table, which is.
+size_t MemoryManager::memoryUsage()
+{
+  waitForIndex();
+  std::lock_guard<std::mutex> lock(mtx_);
+  return refreshUsage();
+}
+
+size_t MemoryManager::refreshUsage()
+{
+  size_t bytes = entries_.memoryUsage() + fresh_.memoryUsage() + index_.memoryUsage();
+  usage_.store(bytes, std::memory_order_relaxed);
+  return bytes;
+}
+
+// SearchFilter as a predicate on labels (ids), so hnswlib can apply it while walking
+// the graph instead of the results being filtered afterwards. Tag conditions are
+// resolved up front into one bitmap of the ids carrying the right tags.
+class EntryFilter : public hnswlib::BaseFilterFunctor
+{
+public:
+  EntryFilter(const EntryStore &entries, const SearchFilter &filter)
+      : entries_(entries), filter_(filter), active_(!filter.empty()),
+        role_(filter.role.empty() ? EntryStore::NO_ENTRY : entries.findRole(filter.role)),
+        has_tags_(!filter.tags.empty() || !filter.any_tags.empty()),
+        role_ids_(role_ == EntryStore::NO_ENTRY ? nullptr : entries.roleIds(role_)),
+        first_id_(std::max(0L, filter.min_id)), last_id_(filter.max_id)
+  {
+    // With sorted timestamps the time bounds narrow the id range too
+    if (entries.timestampsSorted())
+    {
+      if (filter.since != std::numeric_limits<int64_t>::min())
+        first_id_ = std::max(first_id_, entries.lowerBoundTime(filter.since));
+      if (filter.until != std::numeric_limits<int64_t>::max())
+        last_id_ = std::min(last_id_, entries.lowerBoundTime(filter.until + 1) - 1);
+    }
+    if (has_tags_)
+      resolveTags();
+  }
+
+  bool active() const { return active_; }
+  // True if no entry can match, e.g. the role was never used
+  bool matchesNothing() const
+  {
+    return (!filter_.role.empty() && role_ == EntryStore::NO_ENTRY) || filter_.since > filter_.until ||
+           first_id_ > last_id_ || (has_tags_ && tagged().empty());
+  }
+
+  // Upper bound on the number of matching entries, from the id range (narrowed by
+  // binary search on the time bounds) and the role and tag bitmaps. O(1).
+  size_t estimate(long end_id) const
+  {
+    long first = first_id_;
+    long last = std::min(end_id - 1, last_id_);
+    size_t bound = last >= first ? last - first + 1 : 0;
+    if (const TagBitmap *ids = smallestBitmap())
+      bound = std::min(bound, ids->cardinality());
+    return bound;
+  }
+
+  bool operator()(hnswlib::labeltype label) override
+  {
+    if (!active_)
+      return true;
+    long id = label;
+    if (id < first_id_ || id > last_id_ || !entries_.contains(id))
+      return false;
+    if (role_ != EntryStore::NO_ENTRY && entries_.roleCode(id) != role_)
+      return false;
+    int64_t timestamp = entries_.timestamp(id);
+    if (timestamp < filter_.since || timestamp > filter_.until)
+      return false;
+    return !has_tags_ || tagged().contains(id);
+  }
+
+  // Collects the matching ids, giving up once there are more than limit of them.
+  // Visits the smaller of the tag and role bitmaps from the start of the id range
+  // if there is one, and the id range otherwise; either way only the fixed-width
+  // columns are read.
+  bool collect(long end_id, size_t limit, std::vector<long> &ids)
+  {
+    long first = first_id_;
+    long last = std::min(end_id - 1, last_id_);
+    bool complete = true;
+    auto visit = [&](long id)
+    {
+      if (!(*this)(id))
+        return true;
+      if (ids.size() == limit)
+        return complete = false;
+      ids.push_back(id);
+      return true;
+    };
+    if (const TagBitmap *bitmap = smallestBitmap())
+    {
+      if (first <= (long)UINT32_MAX)
+        bitmap->forEachFrom(first, [&](uint32_t id)
+                            { return (long)id <= last && visit(id); });
+      return complete;
+    }
+    for (long id = first; id <= last && complete; ++id)
+      visit(id);
+    return complete;
+  }
+
+private:
+  // All of filter_.tags and any of filter_.any_tags, smallest bitmaps first
+  void resolveTags()
+  {
+    std::vector<const TagBitmap *> all;
+    for (const std::string &tag : filter_.tags)
+    {
+      const TagBitmap *bitmap = entries_.tagIndex().find(tag);
+      if (!bitmap)
+        return; // tagged_ stays empty
+      all.push_back(bitmap);
+    }
+    std::sort(all.begin(), all.end(), [](const TagBitmap *a, const TagBitmap *b)
+              { return a->cardinality() < b->cardinality(); });
+
+    std::vector<const TagBitmap *> any;
+    for (const std::string &tag : filter_.any_tags)
+    {
+      if (const TagBitmap *bitmap = entries_.tagIndex().find(tag))
+        any.push_back(bitmap);
+    }
+    if (!filter_.any_tags.empty() && any.empty())
+      return;
+
+    // A single tag is used in place; anything else is combined into a copy
+    if (all.size() + any.size() == 1)
+    {
+      single_ = all.empty() ? any[0] : all[0];
+      return;
+    }
+    if (!any.empty())
+    {
+      tagged_ = *any[0];
+      for (size_t i = 1; i < any.size(); ++i)
+        tagged_ |= *any[i];
+      for (const TagBitmap *bitmap : all)
+        tagged_ &= *bitmap;
+      return;
+    }
+    tagged_ = *all[0];
+    for (size_t i = 1; i < all.size() && !tagged_.empty(); ++i)
+      tagged_ &= *all[i];
+  }
+
+  const TagBitmap &tagged() const { return single_ ? *single_ : tagged_; }
+
+  // The smaller of the tag and role bitmaps that apply, or nullptr for neither
+  const TagBitmap *smallestBitmap() const
+  {
+    const TagBitmap *tags = has_tags_ ? &tagged() : nullptr;
+    if (!tags || (role_ids_ && role_ids_->cardinality() < tags->cardinality()))
+      return role_ids_;
+    return tags;
+  }
+
+  const EntryStore &entries_;
+  const SearchFilter &filter_;
+  bool active_;
+  uint8_t role_;
+  bool has_tags_;
+  const TagBitmap *role_ids_; // nullptr without a role or if the store has no role bitmaps
+  long first_id_; // filter_'s id range, narrowed by its time range
+  long last_id_;
+  const TagBitmap *single_ = nullptr;
+  TagBitmap tagged_;
+};
+
+static void appendTagParams(std::string &params, const char *name, std::vector<std::string> tags)
+{
+  std::sort(tags.begin(), tags.end()); // the order tags are listed in does not matter
+  params.push_back('\0');
+  params += name;
+  for (const std::string &tag : tags)
+  {
+    params.push_back('\0');
+    params += tag;
+  }
+}
+
+static std::string filterParams(const SearchFilter &filter)
+{
+  std::string params;
+  if (filter.empty())
+    return params;
+  for (const std::string &field : {filter.role, std::to_string(filter.since), std::to_string(filter.until),
+                                   std::to_string(filter.min_id), std::to_string(filter.max_id)})
+  {
+    params.push_back('\0');
+    params += field;
+  }
+  appendTagParams(params, "tags", filter.tags);
+  appendTagParams(params, "any_tags", filter.any_tags);
+  return params;
+}
+
+// Everything besides the query text that changes a search's result
+std::string MemoryManager::searchParams(int k, const SearchOptions &options)
+{
+  if (options.range)
+  {
+    return std::string("range\0", 6) + std::to_string(options.max_distance) + '\0' + std::to_string(options.min_results) +
+           '\0' + std::to_string(options.max_results) + '\0' + std::to_string(options.ef) + filterParams(options.filter);
+  }
+  return std::to_string(k) + '\0' + std::to_string(options.ef) + filterParams(options.filter);
+}
+
+// Retrieve relevant memories with cosine similarity using hnswlib. Results are
+// cached per key; a cached result from before the latest adds is reused when
+// none of the new entries would have made it into the result. A query missing
+// from the cache may still land next to an earlier one once embedded, and then
+// takes over that query's result. The query is embedded before taking mtx_ (the
+// generator serializes its own calls), so adds and recent reads are not held up
+// by embedding.
+std::vector<MemoryView> MemoryManager::searchText(const std::string &key, const std::string &query, int k,
+                                                  const SearchOptions &options)
+{
+  std::vector<MemoryView> results;
+  if (query.empty())
+  {
+    return results;
+  }
+
+  QuerySearch search;
+  search.key = key;
+  search.params = searchParams(k, options);
+  findCached(search);
+  if (!search.cached)
+  {
+    std::vector<float> embedding;
+    try
+    {
+      // Use TaskType::Query when searching
+      embedding = generateEmbedding(query, TaskType::Query);
+      normalizeVector(embedding);
+    }
+    catch (const std::runtime_error &e)
+    {
+      std::cerr << "Error during semantic search: " << e.what() << std::endl;
+      return results;
+    }
+    findSimilar(search, std::move(embedding));
+  }
 
-  if (index_->cur_element_count == 0 || query.empty())
+  std::lock_guard<std::mutex> lock(mtx_);
+  bool from_cache = search.cached && cachedSearchHolds(*search.cached, k, options);
+  if (!from_cache)
+  {
+    std::vector<float> vector = *search.embedding;
+    search.hits = searchVector(vector, k, options, query);
+  }
+  finishSearch(search, from_cache);
+
+  for (const SearchHit &hit : search.hits)
+    results.push_back(viewAt(hit.id));
+  return results;
+}
+
+void MemoryManager::findCached(QuerySearch &search)
+{
+  search.cached = result_cache_.get(search.key);
+  if (search.cached)
+    search.embedding = search.cached->embedding;
+}
+
+void MemoryManager::findSimilar(QuerySearch &search, std::vector<float> embedding)
+{
+  search.embedding = std::make_shared<const std::vector<float>>(std::move(embedding));
+  search.similar = similar_queries_.find(*search.embedding, search.params);
+  search.cached = search.similar.value; // checked against new entries with its own embedding
+}
+
+void MemoryManager::finishSearch(QuerySearch &search, bool from_cache)
+{
+  std::shared_ptr<const CachedSearch> cached = search.cached;
+  if (from_cache)
+  {
+    search.hits = cached->hits;
+    bool revalidated = cached->end_id != (uint64_t)next_id_;
+    if (revalidated)
+    {
+      auto refreshed = std::make_shared<CachedSearch>(*cached);
+      refreshed->end_id = next_id_;
+      cached = std::move(refreshed);
+    }
+    if (search.similar.value)
+    {
+      // Also kept under this query's text, so repeating it skips the embedding. It
+      // carries this query's own embedding, which a later search would start from.
+      auto own = std::make_shared<CachedSearch>(*cached);
+      own->embedding = search.embedding;
+      result_cache_.put(search.key, std::move(own));
+      if (revalidated)
+        similar_queries_.put(search.params, cached, search.similar.slot);
+    }
+    else if (revalidated)
+    {
+      result_cache_.put(search.key, cached);
+    }
+  }
+  else
+  {
+    auto entry = std::make_shared<CachedSearch>();
+    entry->end_id = next_id_;
+    entry->embedding = search.embedding;
+    entry->hits = search.hits;
+    result_cache_.put(search.key, entry);
+    // A neighbour that went stale gives up its slot to this query
+    similar_queries_.put(search.params, std::move(entry), search.similar.slot);
+  }
+}
+
+// Caller holds mtx_. Entries are only ever added, so a cached result is stale only if
+// an entry added since it was computed is closer than its worst hit, or is within the
+// threshold while the result had room left (or any entry at all, while a range
+// result is short of min_results). Checking them is one distance each.
+bool MemoryManager::cachedSearchHolds(const CachedSearch &cached, int k, const SearchOptions &options) const
+{
+  if (cached.end_id == (uint64_t)next_id_)
+    return true;
+  if ((uint64_t)next_id_ - cached.end_id > MAX_CACHE_REVALIDATION)
+    return false;
+
+  float threshold = options.range ? options.max_distance : SEARCH_THRESHOLD;
+  size_t limit = options.range ? options.max_results : (size_t)k;
+  if (options.range && cached.hits.size() < options.min_results)
+    return false;
+  bool full = cached.hits.size() >= limit;
+  float worst = cached.hits.empty() ? threshold : cached.hits.back().distance;
+  auto dist = space_->get_dist_func();
+  void *dist_param = space_->get_dist_func_param();
+  EntryFilter filter(entries_, options.filter);
+  for (long id = cached.end_id; id < next_id_; ++id)
+  {
+    if (!filter(id))
+      continue;
+    const float *vector = vectorOf(id);
+    if (!vector)
+      continue; // never embedded
+    float d = dist(cached.embedding->data(), vector, dist_param);
+    if (d < worst || (!full && d <= threshold))
+      return false;
+  }
+  return true;
+}
+
+// EpsilonSearchStopCondition uses one minimum both for how many candidates the walk
+// collects before it may stop at the radius and for what survives the final filter,
+// which drops everything outside the radius. Here the walk collects at least
+// `explore` candidates (so it does not stop at a far entry point), and the filter
+// keeps the nearest min_results of them even outside the radius.
+class RangeStopCondition : public hnswlib::EpsilonSearchStopCondition<float>
+{
+public:
+  RangeStopCondition(float max_distance, size_t min_results, size_t max_results, size_t explore)
+      : EpsilonSearchStopCondition(max_distance, std::max(explore, min_results),
+                                   std::max({explore, min_results, max_results})),
+        max_distance_(max_distance), min_results_(min_results), max_results_(max_results) {}
+
+  // candidates are sorted nearest first
+  void filter_results(std::vector<std::pair<float, hnswlib::labeltype>> &candidates) override
+  {
+    size_t keep = std::min(candidates.size(), max_results_);
+    while (keep > min_results_ && candidates[keep - 1].first > max_distance_)
+      --keep;
+    candidates.resize(keep);
+  }
+
+private:
+  float max_distance_;
+  size_t min_results_;
+  size_t max_results_;
+};
+
+// Caller holds mtx_. The vector is normalized here for cosine similarity; label is only logged.
+std::vector<SearchHit> MemoryManager::searchVector(std::vector<float> &query_vector, int k, const SearchOptions &options,
+                                                   const std::string &label)
+{
+  std::vector<SearchHit> results;
+
+  if ((index_.size() == 0 && fresh_.size() == 0) || query_vector.size() != (size_t)dimension_)
   {
     return results;
   }
 
   try
   {
-    // Use TaskType::Query when searching
-    std::vector<float> query_embedding = generateEmbedding(query, TaskType::Query); // <-- CHANGE HERE
-    normalizeVector(query_embedding);                                               // Normalize query embedding for cosine similarity
+    normalizeVector(query_vector);
+
+    std::unordered_set<std::string_view> seen_content;
+    float dynamic_threshold = SEARCH_THRESHOLD;
+    size_t limit = k;
+    size_t min_results = 0;
+    if (options.range)
+    {
+      dynamic_threshold = options.max_distance;
+      limit = options.max_results;
+      min_results = std::min(options.min_results, limit);
+    }
 
-    size_t search_k = k * 5; // Retrieve more to filter by threshold
-    auto knn = index_->searchKnn(query_embedding.data(), search_k);
+    EntryFilter filter(entries_, options.filter);
+    if (filter.matchesNothing())
+    {
+      return results;
+    }
+    hnswlib::BaseFilterFunctor *graph_filter = filter.active() ? &filter : nullptr;
+    std::vector<long> matches;
 
-    std::unordered_set<std::string> seen_content;
-    const float BASE_THRESHOLD = 0.75f;
-    float dynamic_threshold = BASE_THRESHOLD;
-    int i = 0;
+    // A filtered walk steps over non-matching nodes without counting them, so it
+    // needs a wider beam to reach as many matches: ef grows with the inverse of the
+    // filter's estimated selectivity
+    size_t ef = options.ef ? options.ef : index_.ef();
+    if (filter.active())
+    {
+      size_t estimate = std::max<size_t>(1, filter.estimate(entries_.endId()));
+      ef = std::max(ef, std::min(MAX_FILTERED_EF, ef * entries_.size() / estimate));
+    }
 
     std::vector<std::pair<float, hnswlib::labeltype>> ranked;
-    while (!knn.empty())
+    if (filter.active() && filter.collect(entries_.endId(), MAX_EXACT_SCAN, matches))
     {
-      ranked.push_back(knn.top());
-      knn.pop();
+      // Few enough entries match that scoring each of them beats a filtered graph
+      // walk, which has to step over every non-matching neighbour
+      auto dist = space_->get_dist_func();
+      void *dist_param = space_->get_dist_func_param();
+      for (long id : matches)
+      {
+        if (const float *vector = vectorOf(id))
+          ranked.emplace_back(dist(query_vector.data(), vector, dist_param), id);
+      }
+      std::sort(ranked.begin(), ranked.end());
+    }
+    else
+    {
+      size_t search_k = options.range ? limit : k * 5; // Retrieve more to filter by threshold
+      // Every shard is walked at once and the results merged nearest first
+      if (index_.size() > 0 && options.range)
+      {
+        ranked = index_.searchStopCondition(
+            query_vector.data(), [&]()
+            { return std::make_unique<RangeStopCondition>(dynamic_threshold, min_results, limit, ef); },
+            limit, graph_filter);
+      }
+      else if (index_.size() > 0)
+      {
+        ranked = index_.searchKnn(query_vector.data(), search_k, ef, graph_filter);
+      }
+
+      // The newest vectors are scored exactly and merged in; those already in the
+      // graph may appear twice, with the same distance
+      if (fresh_.size() > 0)
+      {
+        auto fresh = fresh_.search(query_vector.data(), search_k, graph_filter);
+        ranked.insert(ranked.end(), fresh.begin(), fresh.end());
+        std::sort(ranked.begin(), ranked.end());
+        ranked.erase(std::unique(ranked.begin(), ranked.end()), ranked.end());
+      }
     }
-    std::reverse(ranked.begin(), ranked.end());
 
     for (const auto &item : ranked)
     {
       // Stop once we have enough results
-      if (results.size() >= (size_t)k)
+      if (results.size() >= limit)
         break;
 
       float dist = item.first;
 
       // Check if the result is within our new, more permissive threshold
-      if (dist <= dynamic_threshold)
+      if (dist <= dynamic_threshold || results.size() < min_results)
       {
-        auto doc_id = item.second;
-        if (memory_data_.count(doc_id))
+        long doc_id = item.second;
+        if (entries_.contains(doc_id))
         {
-          const auto &entry = memory_data_[doc_id];
           // Add the result if we haven't seen this exact content before
-          if (seen_content.insert(entry.content).second)
+          if (seen_content.insert(entries_.content(doc_id)).second)
           {
-            results.push_back(entry);
+            results.push_back(SearchHit{doc_id, dist});
           }
         }
       }
     }
 
-    std::cout << "Query: '" << query << "' Final threshold: " << dynamic_threshold
-              << " Results found: " << results.size() << "/" << k << "\n";
+    std::cout << "Query: '" << label << "' Final threshold: " << dynamic_threshold
+              << " Results found: " << results.size() << "/" << limit << "\n";
     if (!ranked.empty())
     {
       std::cout << "Best match cosine distance: " << ranked[0].first << "\n";
@@ -220,87 +1145,679 @@ std::vector<MemoryEntry> MemoryManager::getRelevantMemories(const std::string &q
   return results;
 }
 
-std::vector<MemoryEntry> MemoryManager::getLastN(int n)
+// Lock-free: the rings hand out stable pointers into the entry arena
+std::vector<RecentEntry> MemoryManager::recentEntries(int n, const std::string &session) const
 {
-  std::lock_guard<std::mutex> lock(mtx_);
+  if (n <= 0)
+    return {};
+  return session.empty() ? short_term_.snapshot(n) : sessions_.snapshot(session, n);
+}
+
+std::vector<MemoryEntry> MemoryManager::getLastN(int n, const std::string &session)
+{
+  waitForMetadata();
   std::vector<MemoryEntry> result;
-  int count = std::clamp(n, 0, (int)short_term_ids_.size());
+  std::vector<RecentEntry> recent = recentEntries(n, session);
+  result.reserve(recent.size());
+  for (const RecentEntry &r : recent)
+  {
+    MemoryEntry entry{r.id, r.timestamp, std::string(entries_.roleName(r.role)),
+                      std::string(r.content, r.content_length), {}};
+    for (std::string_view tag : EntryStore::unpackTags(std::string_view(r.tags, r.tags_length)))
+      entry.tags.emplace_back(tag);
+    result.push_back(std::move(entry));
+  }
+  return result;
+}
 
-  auto it = short_term_ids_.rbegin();
-  for (int i = 0; i < count; ++i, ++it)
+std::vector<MemoryView> MemoryManager::getLastNViews(int n, const std::string &session)
+{
+  waitForMetadata();
+  std::vector<MemoryView> result;
+  std::vector<RecentEntry> recent = recentEntries(n, session);
+  result.reserve(recent.size());
+  for (const RecentEntry &r : recent)
   {
-    if (memory_data_.count(*it))
+    result.push_back(MemoryView{r.id, r.timestamp, entries_.roleName(r.role),
+                                std::string_view(r.content, r.content_length),
+                                std::string_view(r.json, r.json_length),
+                                std::string_view(r.tags, r.tags_length)});
+  }
+  return result;
+}
+
+std::string MemoryManager::getLastNJson(int n, bool pretty, const std::string &session)
+{
+  return joinViews(getLastNViews(n, session), pretty);
+}
+
+std::vector<MemoryEntry> MemoryManager::getRange(const TimeRange &range, long &next_cursor)
+{
+  MemoryPage page = getRangeViews(range);
+  std::vector<MemoryEntry> result;
+  result.reserve(page.views.size());
+  for (const MemoryView &view : page.views)
+    result.push_back(toEntry(view));
+  next_cursor = page.next_cursor;
+  return result;
+}
+
+MemoryPage MemoryManager::getRangeViews(const TimeRange &range)
+{
+  waitForMetadata();
+  MemoryPage page;
+  if (range.limit == 0 || range.from > range.to)
+    return page;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  long end = entries_.endId();
+  bool sorted = entries_.timestampsSorted();
+  long id = std::max({0L, range.cursor, entries_.lowerBoundTime(range.from)});
+  for (; id < end; ++id)
+  {
+    if (!entries_.contains(id))
+      continue;
+    int64_t timestamp = entries_.timestamp(id);
+    if (timestamp > range.to)
+    {
+      if (sorted)
+        break; // every later entry is newer still
+      continue;
+    }
+    if (timestamp < range.from)
+      continue;
+    if (page.views.size() == range.limit)
     {
-      result.push_back(memory_data_[*it]);
+      page.next_cursor = id;
+      break;
     }
+    page.views.push_back(viewAt(id));
+  }
+  return page;
+}
+
+std::string MemoryManager::getRangeJson(const TimeRange &range, bool pretty)
+{
+  MemoryPage page = getRangeViews(range);
+  std::string out = pretty ? "{\n\"memories\": " : "{\"memories\":";
+  out += joinViews(page.views, pretty);
+  out += pretty ? ",\n\"next_cursor\": " : ",\"next_cursor\":";
+  out += page.next_cursor < 0 ? "null" : std::to_string(page.next_cursor);
+  out += pretty ? "\n}" : "}";
+  return out;
+}
+
+std::string MemoryManager::dataPath(const std::string &name) const
+{
+  return (std::filesystem::path(config_.data_dir) / name).string();
+}
+
+// Shard 0 keeps the unsharded name, so a single-shard store writes the same files as before
+static std::string indexFileName(const std::string &stem, size_t shard, const std::string &extension)
+{
+  return stem + (shard == 0 ? "" : ".s" + std::to_string(shard)) + extension;
+}
+
+bool MemoryManager::checkpoint(std::unique_lock<std::mutex> &lock)
+{
+  // Saved indexes hold every vector; whatever is still pending goes into the graph
+  // now, including vectors added while an earlier batch was inserted
+  do
+    indexPending(lock, fresh_.pendingCount());
+  while (fresh_.pendingCount() > 0 || indexing_);
+  if (!has_manifest_ || force_full_save_)
+    return saveToDisk();
+  return saveDelta();
+}
+
+// Writes a new generation next to the current one, then atomically points MANIFEST
+// at it. A crash at any point leaves MANIFEST naming a complete, fsynced pair.
+bool MemoryManager::saveToDisk()
+{
+  Generation g;
+  g.generation = last_generation_ + 1;
+  g.metadata_file = "memory_data." + std::to_string(g.generation) + ".bin";
+  std::vector<std::string> index_paths;
+  std::string metadata_path = dataPath(g.metadata_file);
+
+  try
+  {
+    for (size_t i = 0; i < index_.shardCount(); ++i)
+    {
+      IndexShardFile shard;
+      shard.file = indexFileName("memory_index." + std::to_string(g.generation), i, ".hnsw");
+      index_paths.push_back(dataPath(shard.file));
+      index_.shard(i).saveIndex(index_paths.back() + ".tmp");
+      commitFile(index_paths.back() + ".tmp", index_paths.back());
+      shard.size = std::filesystem::file_size(index_paths.back());
+      shard.crc = fileCrc32(index_paths.back());
+      shard.count = index_.shard(i).cur_element_count;
+      g.setIndexShard(i, shard);
+    }
+
+    MetadataWriter writer;
+    for (long id = 0; id < entries_.endId(); ++id)
+    {
+      if (entries_.contains(id))
+        writer.add(id, entries_.timestamp(id), entries_.role(id), entries_.content(id), entries_.tags(id));
+    }
+    writer.write(metadata_path + ".tmp");
+    commitFile(metadata_path + ".tmp", metadata_path);
+    g.metadata_size = std::filesystem::file_size(metadata_path);
+    g.record_count = entries_.size();
+
+    Manifest next;
+    next.current = g;
+    if (has_manifest_)
+      next.previous = manifest_.current;
+    writeManifest(dataPath("MANIFEST"), next);
+
+    // The old previous generation is no longer referenced
+    if (has_manifest_ && manifest_.previous)
+      removeGenerationFiles(*manifest_.previous);
+
+    index_.clearDirty();
+    checkpoint_next_id_ = next_id_;
+    force_full_save_ = false;
+    manifest_ = next;
+    has_manifest_ = true;
+    last_generation_ = g.generation;
+    return true;
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error saving generation " << g.generation << " to disk: " << e.what() << std::endl;
+    std::error_code ec;
+    for (const auto &index_path : index_paths)
+      std::filesystem::remove(index_path + ".tmp", ec);
+    std::filesystem::remove(metadata_path + ".tmp", ec);
+    return false;
   }
-  std::reverse(result.begin(), result.end());
-  return result;
 }
 
-void MemoryManager::saveToDisk()
+// Appends the index elements modified and the entries added since the last
+// checkpoint to the current generation. Cost scales with the write rate.
+bool MemoryManager::saveDelta()
 {
-  std::string hnsw_index_path = "memory_index.hnsw";
-  std::string text_file_path = "memory_data.json";
+  Generation &current = manifest_.current;
+  std::string suffix = std::to_string(current.generation) + "." + std::to_string(current.deltas.size() + 1);
+  DeltaCheckpoint d;
+  d.metadata_file = "memory_data." + suffix + ".bin";
+  std::vector<std::string> index_paths;
+  std::string metadata_path = dataPath(d.metadata_file);
 
-  // Save HNSW index
-  index_->saveIndex(hnsw_index_path);
+  try
+  {
+    // saveDelta clears the dirty bits it writes, so any failure from here on
+    // means only a full save can capture the current state again
+    force_full_save_ = true;
+    for (size_t i = 0; i < index_.shardCount(); ++i)
+    {
+      IndexShardFile shard;
+      shard.file = indexFileName("memory_index." + suffix, i, ".delta");
+      index_paths.push_back(dataPath(shard.file));
+      index_.shard(i).saveDelta(index_paths.back() + ".tmp");
+      commitFile(index_paths.back() + ".tmp", index_paths.back());
+      shard.size = std::filesystem::file_size(index_paths.back());
+      shard.count = index_.shard(i).cur_element_count;
+      d.setIndexShard(i, shard);
+    }
+
+    MetadataWriter writer;
+    for (long id = checkpoint_next_id_; id < next_id_; ++id)
+    {
+      if (!entries_.contains(id))
+        continue;
+      writer.add(id, entries_.timestamp(id), entries_.role(id), entries_.content(id), entries_.tags(id));
+      ++d.record_count;
+    }
+    writer.write(metadata_path + ".tmp");
+    commitFile(metadata_path + ".tmp", metadata_path);
+    d.metadata_size = std::filesystem::file_size(metadata_path);
+
+    Manifest next = manifest_;
+    next.current.deltas.push_back(d);
+    writeManifest(dataPath("MANIFEST"), next);
+
+    manifest_ = next;
+    checkpoint_next_id_ = next_id_;
+    force_full_save_ = false;
+    return true;
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error saving delta " << suffix << " to disk: " << e.what() << std::endl;
+    std::error_code ec;
+    for (const auto &index_path : index_paths)
+      std::filesystem::remove(index_path + ".tmp", ec);
+    std::filesystem::remove(metadata_path + ".tmp", ec);
+    return false;
+  }
+}
+
+// Folds the current generation's deltas into a new base generation. Works only
+// from the files on disk, so it runs on the saver thread without holding mtx_.
+void MemoryManager::mergeDeltas()
+{
+  const Generation base = manifest_.current;
+  Generation g;
+  g.generation = last_generation_ + 1;
+  g.metadata_file = "memory_data." + std::to_string(g.generation) + ".bin";
+  std::vector<std::string> index_paths;
+  std::string metadata_path = dataPath(g.metadata_file);
 
   try
   {
-    std::ofstream out(text_file_path);
-    if (out.is_open())
+    auto start = std::chrono::steady_clock::now();
+    // Shards are merged one at a time, so only one extra shard is in memory
+    size_t shards = base.shardCount();
+    size_t shard_capacity = (max_elements_ + shards - 1) / shards;
+    for (size_t i = 0; i < shards; ++i)
     {
-      json j = json::array();
-      for (const auto &pair : memory_data_)
+      IndexShardFile shard;
+      shard.file = indexFileName("memory_index." + std::to_string(g.generation), i, ".hnsw");
+      index_paths.push_back(dataPath(shard.file));
       {
-        j.push_back(pair.second);
+        hnswlib::HierarchicalNSW<float> merged(space_, dataPath(base.indexShard(i).file), false, shard_capacity);
+        for (const auto &d : base.deltas)
+          merged.applyDelta(dataPath(d.indexShard(i).file));
+        merged.saveIndex(index_paths.back() + ".tmp");
+        shard.count = merged.cur_element_count;
       }
-      out << j.dump(2);
+      commitFile(index_paths.back() + ".tmp", index_paths.back());
+      shard.size = std::filesystem::file_size(index_paths.back());
+      shard.crc = fileCrc32(index_paths.back());
+      g.setIndexShard(i, shard);
     }
+
+    MetadataWriter writer;
+    std::vector<std::string> metadata_files{base.metadata_file};
+    for (const auto &d : base.deltas)
+      metadata_files.push_back(d.metadata_file);
+    for (const auto &file : metadata_files)
+    {
+      MetadataStore store;
+      store.open(dataPath(file));
+      for (size_t i = 0; i < store.size(); ++i)
+      {
+        const MetadataRecord &r = store.record(i);
+        std::vector<std::string_view> tags;
+        for (uint32_t code : store.tagCodes(i))
+          tags.push_back(store.tag(code));
+        writer.add(r.id, r.timestamp, store.role(r.role), store.content(r), tags);
+        ++g.record_count;
+      }
+    }
+    writer.write(metadata_path + ".tmp");
+    commitFile(metadata_path + ".tmp", metadata_path);
+    g.metadata_size = std::filesystem::file_size(metadata_path);
+
+    Manifest next;
+    next.current = g;
+    next.previous = base;
+    writeManifest(dataPath("MANIFEST"), next);
+
+    if (manifest_.previous)
+      removeGenerationFiles(*manifest_.previous);
+    manifest_ = next;
+    last_generation_ = g.generation;
+
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Merged " << base.deltas.size() << " deltas into generation " << g.generation
+              << " in " << ms << " ms." << std::endl;
   }
-  catch (...)
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error merging deltas into generation " << g.generation << ": " << e.what() << std::endl;
+    std::error_code ec;
+    for (const auto &index_path : index_paths)
+      std::filesystem::remove(index_path + ".tmp", ec);
+    std::filesystem::remove(metadata_path + ".tmp", ec);
+    // Don't reuse the number of a generation that may be partially on disk
+    last_generation_ = g.generation;
+  }
+}
+
+std::vector<std::string> MemoryManager::generationFiles(const Generation &generation) const
+{
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < generation.shardCount(); ++i)
+    paths.push_back(dataPath(generation.indexShard(i).file));
+  paths.push_back(dataPath(generation.metadata_file));
+  for (const auto &d : generation.deltas)
+  {
+    for (size_t i = 0; i < d.shardCount(); ++i)
+      paths.push_back(dataPath(d.indexShard(i).file));
+    paths.push_back(dataPath(d.metadata_file));
+  }
+  return paths;
+}
+
+void MemoryManager::removeGenerationFiles(const Generation &generation)
+{
+  std::error_code ec;
+  for (const auto &path : generationFiles(generation))
+    std::filesystem::remove(path, ec);
+}
+
+// Renames the files of a damaged generation to <file>.corrupt, so they are kept for
+// inspection but no later load or save picks them up. Files the loaded generation
+// also names are left alone.
+void MemoryManager::setAsideGenerationFiles(const Generation &damaged, const Generation &loaded)
+{
+  std::vector<std::string> keep = generationFiles(loaded);
+  for (const auto &path : generationFiles(damaged))
+  {
+    if (std::find(keep.begin(), keep.end(), path) != keep.end())
+      continue;
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec))
+      continue;
+    std::filesystem::rename(path, path + ".corrupt", ec);
+    if (ec)
+      std::cerr << "Cannot set aside " << path << ": " << ec.message() << std::endl;
+  }
+}
+
+// Loads metadata under mtx_ and calls metadata_loaded once it is in, with mtx_
+// released, while the index is still loading. The index is only touched by
+// searches, adds and the background threads, none of which start before startup()
+// is done, so it is loaded without mtx_.
+void MemoryManager::loadFromDisk(const std::function<void()> &metadata_loaded)
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  Manifest manifest;
+  bool found = false;
+  try
+  {
+    found = readManifest(dataPath("MANIFEST"), manifest);
+  }
+  catch (const std::runtime_error &e)
+  {
+    std::cerr << e.what() << std::endl;
+  }
+
+  if (found)
+  {
+    last_generation_ = manifest.current.generation;
+    if (loadGeneration(manifest.current, lock, metadata_loaded))
+    {
+      manifest_ = manifest;
+      has_manifest_ = true;
+      return;
+    }
+    // Readers may already be in, so the fallback holds mtx_ throughout and they see
+    // either the damaged generation's metadata or the previous generation's
+    if (manifest.previous && loadGeneration(*manifest.previous, lock, nullptr))
+    {
+      std::cerr << "Generation " << manifest.current.generation << " is damaged, fell back to generation "
+                << manifest.previous->generation << "; its files are renamed to *.corrupt." << std::endl;
+      setAsideGenerationFiles(manifest.current, *manifest.previous);
+      manifest_.current = *manifest.previous;
+      manifest_.previous.reset();
+      has_manifest_ = true;
+      force_full_save_ = true;
+      return;
+    }
+    std::cerr << "No valid generation in MANIFEST, starting with an empty store." << std::endl;
+    return;
+  }
+
+  std::string legacy_index_path = dataPath(legacy_index_file);
+  std::string legacy_metadata_path = dataPath(legacy_metadata_file);
+  std::thread index_thread([&]()
+                           {
+    auto start = std::chrono::steady_clock::now();
+    if (std::filesystem::exists(legacy_index_path)) {
+      try {
+        // A pre-manifest index is a single shard
+        index_.reset(1, HNSW_M, HNSW_EF_CONSTRUCTION);
+        loadIndex(0, legacy_index_path);
+      } catch (const std::runtime_error &e) {
+        std::cerr << "Error loading HNSW index: " << e.what() << std::endl;
+        index_.reset(config_.index_shards, HNSW_M, HNSW_EF_CONSTRUCTION);
+      }
+    } else {
+      std::cerr << "HNSW index file not found. Creating a new one." << std::endl;
+    }
+    timings_.index_ms = elapsedMs(start); });
+
+  auto start = std::chrono::steady_clock::now();
+  if (!std::filesystem::exists(legacy_metadata_path) && std::filesystem::exists(dataPath(legacy_text_file)))
+  {
+    migrateJsonMetadata();
+  }
+  if (std::filesystem::exists(legacy_metadata_path))
   {
-    std::cerr << "Error saving memory text data to disk." << std::endl;
+    try
+    {
+      loadMetadata(legacy_metadata_path);
+    }
+    catch (const std::runtime_error &e)
+    {
+      std::cerr << "Error loading memory metadata: " << e.what() << std::endl;
+    }
   }
+  timings_.metadata_ms = elapsedMs(start);
+  lock.unlock();
+  metadata_loaded();
+  index_thread.join();
 }
 
-void MemoryManager::loadFromDisk()
+// Loads one generation named by the manifest, leaving an empty store if any check fails.
+// The index (with its deltas) and the metadata are loaded on separate threads. lock
+// holds mtx_; if metadata_loaded is set, it is released to call it once the metadata
+// is in and taken again after the index.
+bool MemoryManager::loadGeneration(const Generation &generation, std::unique_lock<std::mutex> &lock,
+                                   const std::function<void()> &metadata_loaded)
 {
-  std::string hnsw_index_path = "memory_index.hnsw";
-  std::string text_file_path = "memory_data.json";
+  std::exception_ptr index_error;
+  std::thread index_thread([&]()
+                           {
+    try {
+      loadGenerationIndex(generation);
+    } catch (...) {
+      index_error = std::current_exception();
+    } });
+
+  try
+  {
+    try
+    {
+      loadGenerationMetadata(generation);
+    }
+    catch (...)
+    {
+      index_thread.join();
+      throw;
+    }
+    if (metadata_loaded)
+    {
+      lock.unlock();
+      metadata_loaded();
+      index_thread.join();
+      lock.lock();
+    }
+    else
+    {
+      index_thread.join();
+    }
+    if (index_error)
+      std::rethrow_exception(index_error);
 
-  if (std::filesystem::exists(hnsw_index_path))
+    if (!generation.deltas.empty())
+      std::cout << "Applied " << generation.deltas.size() << " deltas." << std::endl;
+    checkpoint_next_id_ = next_id_;
+    return true;
+  }
+  catch (const std::exception &e)
   {
-    delete index_;
-    index_ = new hnswlib::HierarchicalNSW<float>(space_, hnsw_index_path);
-    std::cout << "Loaded HNSW index with "
-              << index_->cur_element_count << " vectors." << std::endl;
+    std::cerr << "Cannot load generation " << generation.generation << ": " << e.what() << std::endl;
+    resetState();
+    return false;
+  }
+}
+
+void MemoryManager::loadGenerationIndex(const Generation &generation)
+{
+  auto start = std::chrono::steady_clock::now();
+  // The shard count is part of the saved store; the configured count only applies to new stores
+  size_t shards = generation.shardCount();
+  if (shards != config_.index_shards)
+    std::cerr << "Store has " << shards << " index shards, keeping them (configured: " << config_.index_shards
+              << ")." << std::endl;
+  index_.reset(shards, HNSW_M, HNSW_EF_CONSTRUCTION);
+  for (const auto &d : generation.deltas)
+  {
+    if (d.shardCount() != shards)
+      throw std::runtime_error(d.index_file + " has the wrong number of shards");
+  }
+
+  // Shards are independent, so each is loaded and brought up to date on its own thread
+  std::vector<std::exception_ptr> errors(shards);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < shards; ++i)
+  {
+    threads.emplace_back([&, i]()
+                         {
+      try {
+        IndexShardFile shard = generation.indexShard(i);
+        std::string index_path = dataPath(shard.file);
+        std::error_code ec;
+        if (std::filesystem::file_size(index_path, ec) != shard.size || ec)
+          throw std::runtime_error(shard.file + " is missing or has the wrong size");
+        if (config_.verify_checksums && fileCrc32(index_path) != shard.crc)
+          throw std::runtime_error(shard.file + " checksum mismatch");
+
+        loadIndex(i, index_path);
+        if (index_.shard(i).cur_element_count != shard.count)
+          throw std::runtime_error(shard.file + " element count mismatch");
+
+        for (const auto &d : generation.deltas)
+        {
+          IndexShardFile delta = d.indexShard(i);
+          if (std::filesystem::file_size(dataPath(delta.file), ec) != delta.size || ec)
+            throw std::runtime_error(delta.file + " is missing or has the wrong size");
+          index_.shard(i).applyDelta(dataPath(delta.file));
+          if (index_.shard(i).cur_element_count != delta.count)
+            throw std::runtime_error(delta.file + " element count mismatch");
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      } });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  for (const auto &error : errors)
+  {
+    if (error)
+      std::rethrow_exception(error);
+  }
+  timings_.index_ms = elapsedMs(start);
+}
+
+void MemoryManager::loadGenerationMetadata(const Generation &generation)
+{
+  auto start = std::chrono::steady_clock::now();
+  std::string metadata_path = dataPath(generation.metadata_file);
+  std::error_code ec;
+  if (std::filesystem::file_size(metadata_path, ec) != generation.metadata_size || ec)
+    throw std::runtime_error(generation.metadata_file + " is missing or has the wrong size");
+  if (loadMetadata(metadata_path) != generation.record_count)
+    throw std::runtime_error(generation.metadata_file + " record count mismatch");
+
+  for (const auto &d : generation.deltas)
+  {
+    if (std::filesystem::file_size(dataPath(d.metadata_file), ec) != d.metadata_size || ec)
+      throw std::runtime_error(d.metadata_file + " is missing or has the wrong size");
+    if (loadMetadata(dataPath(d.metadata_file)) != d.record_count)
+      throw std::runtime_error(d.metadata_file + " record count mismatch");
+  }
+  timings_.metadata_ms = elapsedMs(start);
+}
+
+void MemoryManager::loadIndex(size_t shard, const std::string &path)
+{
+  std::unique_ptr<hnswlib::HierarchicalNSW<float>> index;
+  if (config_.mmap_index)
+  {
+    index = std::make_unique<hnswlib::HierarchicalNSW<float>>(space_);
+    index->loadIndexMapped(path, space_, index_.shardCapacity());
   }
   else
   {
-    std::cerr << "HNSW index file not found. Creating a new one." << std::endl;
-    delete index_;
-    index_ = new hnswlib::HierarchicalNSW<float>(space_, max_elements_, 16, 200);
+    index = std::make_unique<hnswlib::HierarchicalNSW<float>>(space_, path, false, index_.shardCapacity());
+  }
+  std::ostringstream message;
+  message << "Loaded HNSW index " << (index_.shardCount() > 1 ? "shard " + std::to_string(shard) + " " : "")
+          << "with " << index->cur_element_count << " vectors" << (config_.mmap_index ? " (mapped)." : ".") << "\n";
+  std::cout << message.str() << std::flush;
+  index_.setShard(shard, std::move(index));
+}
+
+void MemoryManager::resetState()
+{
+  index_.reset(config_.index_shards, HNSW_M, HNSW_EF_CONSTRUCTION);
+  entries_.clear();
+  fresh_.clear();
+  short_term_.clear();
+  sessions_.clear();
+  result_cache_.clear();
+  similar_queries_.clear();
+  next_id_ = 0;
+  checkpoint_next_id_ = 0;
+}
+
+// Every file is verified, the legacy one too: verify() also bounds-checks the
+// record, role and tag sections that EntryStore::load() indexes by
+size_t MemoryManager::loadMetadata(const std::string &path)
+{
+  MetadataStore store;
+  store.open(path);
+  if (!store.verify())
+    throw std::runtime_error(path + " is corrupted (checksum or bounds mismatch)");
+
+  entries_.load(store);
+  if (entries_.endId() > next_id_)
+  {
+    next_id_ = entries_.endId();
   }
+  std::cout << "Loaded " << store.size() << " memory entries." << std::endl;
+  return store.size();
+}
 
-  std::ifstream in(text_file_path);
-  if (in.is_open())
+// One-shot conversion of the old pretty-printed JSON array into memory_data.bin.
+// The JSON file is kept alongside as memory_data.json.migrated.
+void MemoryManager::migrateJsonMetadata()
+{
+  std::string text_path = dataPath(legacy_text_file);
+  std::string metadata_path = dataPath(legacy_metadata_file);
+  try
   {
+    std::ifstream in(text_path);
     json j;
     in >> j;
-    if (j.is_array())
+    if (!j.is_array())
     {
-      for (const auto &item : j)
-      {
-        MemoryEntry entry = item.get<MemoryEntry>();
-        memory_data_[entry.id] = entry;
+      std::cerr << "Legacy metadata file is not a JSON array, skipping migration." << std::endl;
+      return;
+    }
 
-        if (entry.id >= next_id_)
-        {
-          next_id_ = entry.id + 1;
-        }
-      }
+    MetadataWriter writer;
+    for (const auto &item : j)
+    {
+      MemoryEntry entry = item.get<MemoryEntry>();
+      writer.add(entry.id, entry.timestamp, entry.role, entry.content);
     }
+    writer.write(metadata_path + ".tmp");
+    commitFile(metadata_path + ".tmp", metadata_path);
+    in.close();
+    std::filesystem::rename(text_path, text_path + ".migrated");
+    std::cout << "Migrated " << j.size() << " entries from " << text_path
+              << " to " << metadata_path << std::endl;
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error migrating " << text_path << ": " << e.what() << std::endl;
   }
 }
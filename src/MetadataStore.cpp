@@ -0,0 +1,301 @@
+#include "MetadataStore.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::array<uint32_t, 256> makeCrcTable()
+{
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    table[i] = c;
+  }
+  return table;
+}
+
+uint32_t crc32(const void *data, size_t size, uint32_t crc)
+{
+  static const std::array<uint32_t, 256> table = makeCrcTable();
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint32_t headerCrc(MetadataHeader h)
+{
+  h.header_crc = 0;
+  return crc32(&h, h.header_size);
+}
+
+MetadataStore::~MetadataStore()
+{
+  close();
+}
+
+void MetadataStore::open(const std::string &path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Cannot open metadata file: " + path);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < METADATA_V1_HEADER_SIZE)
+  {
+    ::close(fd);
+    throw std::runtime_error("Metadata file is truncated: " + path);
+  }
+
+  void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED)
+    throw std::runtime_error("Cannot mmap metadata file: " + path);
+
+  base_ = base;
+  mapped_size_ = st.st_size;
+
+  MetadataHeader h{};
+  std::memcpy(&h, base_, METADATA_V1_HEADER_SIZE);
+  bool known = (h.version == 1 && h.header_size == METADATA_V1_HEADER_SIZE && h.tag_count == 0) ||
+               (h.version == METADATA_VERSION && h.header_size == sizeof(MetadataHeader) &&
+                mapped_size_ >= sizeof(MetadataHeader));
+  if (known && h.version == METADATA_VERSION)
+    std::memcpy(&h, base_, sizeof(MetadataHeader));
+
+  size_t tag_ranges = h.tag_count ? h.record_count : 0;
+  size_t expected = h.header_size + ((size_t)h.role_count + h.tag_count) * sizeof(MetadataRoleSlot) +
+                    (size_t)h.record_count * sizeof(MetadataRecord) + tag_ranges * sizeof(MetadataTagRange) +
+                    (size_t)h.tag_link_count * sizeof(uint32_t) + h.heap_size;
+  if (std::memcmp(h.magic, METADATA_MAGIC, sizeof(h.magic)) != 0 || !known ||
+      h.header_crc != headerCrc(h) || expected != mapped_size_)
+  {
+    close();
+    throw std::runtime_error("Metadata file is corrupted or unsupported: " + path);
+  }
+
+  const char *p = static_cast<const char *>(base_) + h.header_size;
+  header_ = h;
+  roles_ = reinterpret_cast<const MetadataRoleSlot *>(p);
+  p += h.role_count * sizeof(MetadataRoleSlot);
+  tags_ = reinterpret_cast<const MetadataRoleSlot *>(p);
+  p += h.tag_count * sizeof(MetadataRoleSlot);
+  records_ = reinterpret_cast<const MetadataRecord *>(p);
+  p += h.record_count * sizeof(MetadataRecord);
+  tag_ranges_ = reinterpret_cast<const MetadataTagRange *>(p);
+  p += tag_ranges * sizeof(MetadataTagRange);
+  tag_links_ = reinterpret_cast<const uint32_t *>(p);
+  p += h.tag_link_count * sizeof(uint32_t);
+  heap_ = p;
+
+  madvise(base_, mapped_size_, MADV_WILLNEED);
+}
+
+void MetadataStore::close()
+{
+  if (base_)
+    munmap(base_, mapped_size_);
+  base_ = nullptr;
+  mapped_size_ = 0;
+  header_ = MetadataHeader{};
+  roles_ = nullptr;
+  tags_ = nullptr;
+  records_ = nullptr;
+  tag_ranges_ = nullptr;
+  tag_links_ = nullptr;
+  heap_ = nullptr;
+}
+
+bool MetadataStore::inHeap(uint64_t offset, uint64_t length) const
+{
+  return offset <= header_.heap_size && length <= header_.heap_size - offset;
+}
+
+bool MetadataStore::verify() const
+{
+  if (!base_)
+    return false;
+  const MetadataHeader &h = header_;
+  size_t tag_ranges = h.tag_count ? h.record_count : 0;
+  uint32_t tags_crc = crc32(tags_, h.tag_count * sizeof(MetadataRoleSlot));
+  tags_crc = crc32(tag_ranges_, tag_ranges * sizeof(MetadataTagRange), tags_crc);
+  tags_crc = crc32(tag_links_, h.tag_link_count * sizeof(uint32_t), tags_crc);
+  if (crc32(roles_, h.role_count * sizeof(MetadataRoleSlot)) != h.roles_crc ||
+      crc32(records_, h.record_count * sizeof(MetadataRecord)) != h.records_crc ||
+      crc32(heap_, h.heap_size) != h.heap_crc || (h.version >= 2 && tags_crc != h.tags_crc))
+    return false;
+
+  for (uint32_t i = 0; i < h.role_count; ++i)
+  {
+    if (!inHeap(roles_[i].offset, roles_[i].length))
+      return false;
+  }
+  for (uint32_t i = 0; i < h.tag_count; ++i)
+  {
+    if (!inHeap(tags_[i].offset, tags_[i].length))
+      return false;
+  }
+  for (size_t i = 0; i < h.record_count; ++i)
+  {
+    const MetadataRecord &r = records_[i];
+    if (r.id < 0 || (i > 0 && r.id <= records_[i - 1].id) || r.role >= h.role_count ||
+        !inHeap(r.content_offset, r.content_length))
+      return false;
+  }
+  for (size_t i = 0; i < tag_ranges; ++i)
+  {
+    const MetadataTagRange &t = tag_ranges_[i];
+    if ((uint64_t)t.first + t.count > h.tag_link_count)
+      return false;
+  }
+  for (uint64_t i = 0; i < h.tag_link_count; ++i)
+  {
+    if (tag_links_[i] >= h.tag_count)
+      return false;
+  }
+  return true;
+}
+
+std::string_view MetadataStore::role(uint32_t code) const
+{
+  if (!roleValid(code))
+    return {};
+  return std::string_view(heap_ + roles_[code].offset, roles_[code].length);
+}
+
+std::string_view MetadataStore::tag(uint32_t code) const
+{
+  if (!tagValid(code))
+    return {};
+  return std::string_view(heap_ + tags_[code].offset, tags_[code].length);
+}
+
+std::string_view MetadataStore::content(const MetadataRecord &r) const
+{
+  return std::string_view(heap_ + r.content_offset, r.content_length);
+}
+
+std::vector<uint32_t> MetadataStore::tagCodes(size_t i) const
+{
+  auto [codes, count] = tagLinks(i);
+  return std::vector<uint32_t>(codes, codes + count);
+}
+
+std::pair<const uint32_t *, uint32_t> MetadataStore::tagLinks(size_t i) const
+{
+  if (header_.tag_count == 0)
+    return {nullptr, 0};
+  const MetadataTagRange &t = tag_ranges_[i];
+  if ((uint64_t)t.first + t.count > header_.tag_link_count)
+    return {nullptr, 0};
+  return {tag_links_ + t.first, t.count};
+}
+
+uint32_t MetadataWriter::internRole(std::string_view role)
+{
+  for (uint32_t i = 0; i < roles_.size(); ++i)
+  {
+    if (std::string_view(heap_.data() + roles_[i].offset, roles_[i].length) == role)
+      return i;
+  }
+  roles_.push_back({heap_.size(), (uint32_t)role.size(), 0});
+  heap_.append(role);
+  return roles_.size() - 1;
+}
+
+uint32_t MetadataWriter::internTag(std::string_view tag)
+{
+  auto it = tag_codes_.find(std::string(tag));
+  if (it != tag_codes_.end())
+    return it->second;
+  tags_.push_back({heap_.size(), (uint32_t)tag.size(), 0});
+  heap_.append(tag);
+  tag_codes_.emplace(std::string(tag), tags_.size() - 1);
+  return tags_.size() - 1;
+}
+
+void MetadataWriter::add(int64_t id, int64_t timestamp, std::string_view role, std::string_view content,
+                         const std::vector<std::string_view> &tags)
+{
+  MetadataRecord r{};
+  r.id = id;
+  r.timestamp = timestamp;
+  r.role = internRole(role);
+  r.content_offset = heap_.size();
+  r.content_length = content.size();
+  heap_.append(content);
+  records_.push_back(r);
+
+  if (tag_links_.size() + tags.size() > UINT32_MAX)
+    throw std::runtime_error("Too many tags for one metadata file");
+  tag_ranges_.push_back({(uint32_t)tag_links_.size(), (uint32_t)tags.size()});
+  for (std::string_view tag : tags)
+    tag_links_.push_back(internTag(tag));
+}
+
+void MetadataWriter::write(const std::string &path)
+{
+  std::vector<size_t> order(records_.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [this](size_t a, size_t b)
+            { return records_[a].id < records_[b].id; });
+  std::vector<MetadataRecord> records;
+  std::vector<MetadataTagRange> tag_ranges;
+  records.reserve(order.size());
+  for (size_t i : order)
+    records.push_back(records_[i]);
+  if (!tags_.empty())
+  {
+    tag_ranges.reserve(order.size());
+    for (size_t i : order)
+      tag_ranges.push_back(tag_ranges_[i]);
+  }
+  else
+  {
+    tag_links_.clear(); // only empty runs
+  }
+
+  MetadataHeader h{};
+  std::memcpy(h.magic, METADATA_MAGIC, sizeof(h.magic));
+  h.version = METADATA_VERSION;
+  h.header_size = sizeof(MetadataHeader);
+  h.record_count = records.size();
+  h.role_count = roles_.size();
+  h.tag_count = tags_.size();
+  h.heap_size = heap_.size();
+  h.tag_link_count = tag_links_.size();
+  h.roles_crc = crc32(roles_.data(), roles_.size() * sizeof(MetadataRoleSlot));
+  h.records_crc = crc32(records.data(), records.size() * sizeof(MetadataRecord));
+  h.heap_crc = crc32(heap_.data(), heap_.size());
+  h.tags_crc = crc32(tags_.data(), tags_.size() * sizeof(MetadataRoleSlot));
+  h.tags_crc = crc32(tag_ranges.data(), tag_ranges.size() * sizeof(MetadataTagRange), h.tags_crc);
+  h.tags_crc = crc32(tag_links_.data(), tag_links_.size() * sizeof(uint32_t), h.tags_crc);
+  h.header_crc = headerCrc(h);
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out.is_open())
+    throw std::runtime_error("Cannot open metadata file for writing: " + path);
+  out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  out.write(reinterpret_cast<const char *>(roles_.data()), roles_.size() * sizeof(MetadataRoleSlot));
+  out.write(reinterpret_cast<const char *>(tags_.data()), tags_.size() * sizeof(MetadataRoleSlot));
+  out.write(reinterpret_cast<const char *>(records.data()), records.size() * sizeof(MetadataRecord));
+  out.write(reinterpret_cast<const char *>(tag_ranges.data()), tag_ranges.size() * sizeof(MetadataTagRange));
+  out.write(reinterpret_cast<const char *>(tag_links_.data()), tag_links_.size() * sizeof(uint32_t));
+  out.write(heap_.data(), heap_.size());
+  out.close();
+  if (!out)
+    throw std::runtime_error("Failed to write metadata file: " + path);
+}
@@ -0,0 +1,190 @@
+#include "Persistence.hpp"
+#include "MetadataStore.hpp"
+#include <nlohmann/json.hpp>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// Version 2 adds index shards. Unsharded stores still write version 1, so an
+// older build can read them; it refuses a sharded one instead of losing shards.
+constexpr int MANIFEST_VERSION = 1;
+constexpr int SHARDED_MANIFEST_VERSION = 2;
+
+static json shardsToJson(const std::vector<IndexShardFile> &shards)
+{
+  json out = json::array();
+  for (const auto &s : shards)
+    out.push_back(json{{"file", s.file}, {"size", s.size}, {"crc", s.crc}, {"count", s.count}});
+  return out;
+}
+
+static std::vector<IndexShardFile> shardsFromJson(const json &j)
+{
+  std::vector<IndexShardFile> shards;
+  for (const auto &s : j)
+  {
+    IndexShardFile shard;
+    s.at("file").get_to(shard.file);
+    s.at("size").get_to(shard.size);
+    s.at("crc").get_to(shard.crc);
+    s.at("count").get_to(shard.count);
+    shards.push_back(shard);
+  }
+  return shards;
+}
+
+static json deltaToJson(const DeltaCheckpoint &d)
+{
+  json j{
+      {"index_file", d.index_file},
+      {"index_size", d.index_size},
+      {"index_count", d.index_count},
+      {"metadata_file", d.metadata_file},
+      {"metadata_size", d.metadata_size},
+      {"record_count", d.record_count}};
+  if (!d.shard_files.empty())
+    j["shards"] = shardsToJson(d.shard_files);
+  return j;
+}
+
+static DeltaCheckpoint deltaFromJson(const json &j)
+{
+  DeltaCheckpoint d;
+  j.at("index_file").get_to(d.index_file);
+  j.at("index_size").get_to(d.index_size);
+  j.at("index_count").get_to(d.index_count);
+  j.at("metadata_file").get_to(d.metadata_file);
+  j.at("metadata_size").get_to(d.metadata_size);
+  j.at("record_count").get_to(d.record_count);
+  if (j.contains("shards"))
+    d.shard_files = shardsFromJson(j["shards"]);
+  return d;
+}
+
+static json generationToJson(const Generation &g)
+{
+  json deltas = json::array();
+  for (const auto &d : g.deltas)
+    deltas.push_back(deltaToJson(d));
+
+  json j{
+      {"generation", g.generation},
+      {"index_file", g.index_file},
+      {"index_size", g.index_size},
+      {"index_crc", g.index_crc},
+      {"index_count", g.index_count},
+      {"metadata_file", g.metadata_file},
+      {"metadata_size", g.metadata_size},
+      {"record_count", g.record_count},
+      {"deltas", deltas}};
+  if (!g.shard_files.empty())
+    j["shards"] = shardsToJson(g.shard_files);
+  return j;
+}
+
+static Generation generationFromJson(const json &j)
+{
+  Generation g;
+  j.at("generation").get_to(g.generation);
+  j.at("index_file").get_to(g.index_file);
+  j.at("index_size").get_to(g.index_size);
+  j.at("index_crc").get_to(g.index_crc);
+  j.at("index_count").get_to(g.index_count);
+  j.at("metadata_file").get_to(g.metadata_file);
+  j.at("metadata_size").get_to(g.metadata_size);
+  j.at("record_count").get_to(g.record_count);
+  if (j.contains("deltas"))
+  {
+    for (const auto &d : j["deltas"])
+      g.deltas.push_back(deltaFromJson(d));
+  }
+  if (j.contains("shards"))
+    g.shard_files = shardsFromJson(j["shards"]);
+  return g;
+}
+
+bool readManifest(const std::string &path, Manifest &manifest)
+{
+  std::ifstream in(path);
+  if (!in.is_open())
+    return false;
+
+  try
+  {
+    json j;
+    in >> j;
+    int version = j.at("version").get<int>();
+    if (version != MANIFEST_VERSION && version != SHARDED_MANIFEST_VERSION)
+      throw std::runtime_error("unsupported manifest version");
+    manifest.current = generationFromJson(j.at("current"));
+    manifest.previous.reset();
+    if (j.contains("previous") && !j["previous"].is_null())
+      manifest.previous = generationFromJson(j["previous"]);
+  }
+  catch (const std::exception &e)
+  {
+    throw std::runtime_error("Cannot read manifest " + path + ": " + e.what());
+  }
+  return true;
+}
+
+void writeManifest(const std::string &path, const Manifest &manifest)
+{
+  bool sharded = manifest.current.shardCount() > 1 || (manifest.previous && manifest.previous->shardCount() > 1);
+  json j = {{"version", sharded ? SHARDED_MANIFEST_VERSION : MANIFEST_VERSION},
+            {"current", generationToJson(manifest.current)}};
+  j["previous"] = manifest.previous ? generationToJson(*manifest.previous) : json(nullptr);
+
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::trunc);
+    if (!out.is_open())
+      throw std::runtime_error("Cannot open " + tmp_path + " for writing");
+    out << j.dump(2);
+    out.close();
+    if (!out)
+      throw std::runtime_error("Failed to write " + tmp_path);
+  }
+  commitFile(tmp_path, path);
+}
+
+void fsyncPath(const std::string &path, bool directory)
+{
+  int fd = ::open(path.c_str(), directory ? (O_RDONLY | O_DIRECTORY) : O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Cannot open " + path + " for fsync");
+  int rc = ::fsync(fd);
+  ::close(fd);
+  if (rc != 0)
+    throw std::runtime_error("fsync failed for " + path);
+}
+
+void commitFile(const std::string &tmp_path, const std::string &final_path)
+{
+  fsyncPath(tmp_path);
+  std::filesystem::rename(tmp_path, final_path);
+
+  std::string dir = std::filesystem::path(final_path).parent_path().string();
+  fsyncPath(dir.empty() ? "." : dir, true);
+}
+
+uint32_t fileCrc32(const std::string &path)
+{
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open())
+    throw std::runtime_error("Cannot open " + path);
+
+  std::vector<char> buf(1 << 20);
+  uint32_t crc = 0;
+  while (in)
+  {
+    in.read(buf.data(), buf.size());
+    crc = crc32(buf.data(), in.gcount(), crc);
+  }
+  return crc;
+}
@@ -0,0 +1,179 @@
+#include "RequestParser.hpp"
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+namespace
+{
+  // Tracks nesting so that only members of the outermost object are captured.
+  // As with a DOM, the last occurrence of a duplicated key wins.
+  class AddRequestSax : public nlohmann::json_sax<json>
+  {
+  public:
+    explicit AddRequestSax(AddRequest &request) : request_(request) {}
+
+    bool null() override { return scalar(); }
+    bool boolean(bool) override { return scalar(); }
+    bool number_integer(number_integer_t) override { return scalar(); }
+    bool number_unsigned(number_unsigned_t) override { return scalar(); }
+    bool number_float(number_float_t, const string_t &) override { return scalar(); }
+    bool binary(binary_t &) override { return scalar(); }
+
+    bool string(string_t &val) override
+    {
+      if (in_tags_ && depth_ == 2)
+      {
+        request_.tags.push_back(std::move(val));
+        return true;
+      }
+      if (depth_ == 1 && target_)
+      {
+        *target_ = std::move(val);
+        seen() = true;
+        target_ = nullptr;
+        return true;
+      }
+      return scalar();
+    }
+
+    bool start_object(std::size_t) override
+    {
+      if (in_tags_)
+        return nestedTag();
+      if (depth_ == 0)
+        is_object_ = true;
+      return enter();
+    }
+    bool end_object() override { return leave(); }
+    bool start_array(std::size_t) override
+    {
+      if (depth_ == 1 && tags_next_)
+      {
+        tags_next_ = false;
+        in_tags_ = true;
+        tags_ok_ = true;
+        ++depth_;
+        return true;
+      }
+      if (in_tags_)
+        return nestedTag();
+      return enter();
+    }
+    bool end_array() override
+    {
+      if (in_tags_ && depth_ == 2)
+        in_tags_ = false;
+      return leave();
+    }
+
+    bool key(string_t &val) override
+    {
+      if (depth_ != 1)
+        return true;
+      tags_next_ = val == "tags";
+      if (tags_next_)
+      {
+        request_.tags.clear();
+        tags_ok_ = false; // until the array is seen
+      }
+      if (val == "role")
+        target_ = &request_.role;
+      else if (val == "content")
+        target_ = &request_.content;
+      else if (val == "session")
+      {
+        target_ = &request_.session;
+        has_session_ = false; // until the string is seen
+      }
+      else
+        target_ = nullptr;
+      return true;
+    }
+
+    bool parse_error(std::size_t, const std::string &, const nlohmann::detail::exception &ex) override
+    {
+      throw std::invalid_argument(ex.what());
+    }
+
+    bool valid() const
+    {
+      return is_object_ && has_role_ && has_content_ && tags_ok_ && validTags(request_.tags) && has_session_ &&
+             (request_.session.empty() || validSession(request_.session));
+    }
+
+  private:
+    // Whether the member target_ points at has been read as a string
+    bool &seen()
+    {
+      if (target_ == &request_.role)
+        return has_role_;
+      return target_ == &request_.content ? has_content_ : has_session_;
+    }
+    bool scalar()
+    {
+      if (in_tags_ && depth_ == 2)
+        tags_ok_ = false; // a tag that is not a string
+      tags_next_ = false;
+      if (depth_ == 1 && target_)
+      {
+        seen() = false;
+        target_ = nullptr;
+      }
+      return true;
+    }
+    // Tags are one flat array of strings; anything nested in it rejects the
+    // request and stops the parse there
+    bool nestedTag()
+    {
+      tags_ok_ = false;
+      return false;
+    }
+    bool enter()
+    {
+      scalar(); // an object or array where a string was expected
+      ++depth_;
+      return true;
+    }
+    bool leave()
+    {
+      --depth_;
+      return true;
+    }
+
+    AddRequest &request_;
+    std::string *target_ = nullptr;
+    int depth_ = 0;
+    bool is_object_ = false;
+    bool has_role_ = false;
+    bool has_content_ = false;
+    bool has_session_ = true; // optional, so only false while a "session" is not a string
+    bool tags_next_ = false; // the next value belongs to "tags"
+    bool in_tags_ = false;
+    bool tags_ok_ = true;
+  };
+}
+
+bool parseAddRequest(std::string_view body, AddRequest &request)
+{
+  AddRequestSax handler(request);
+  json::sax_parse(body.begin(), body.end(), &handler);
+  return handler.valid();
+}
+
+bool validTags(const std::vector<std::string> &tags)
+{
+  if (tags.size() > MAX_TAGS)
+    return false;
+  for (const std::string &tag : tags)
+  {
+    if (tag.empty() || tag.size() > MAX_TAG_LENGTH || tag.find_first_of(std::string(",\0", 2)) != std::string::npos)
+      return false;
+  }
+  return true;
+}
+
+bool validSession(const std::string &session)
+{
+  return !session.empty() && session.size() <= MAX_SESSION_LENGTH;
+}
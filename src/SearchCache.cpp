@@ -0,0 +1,125 @@
+#include "SearchCache.hpp"
+
+std::shared_ptr<const CachedSearch> SearchCache::get(const std::string &key)
+{
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto it = index_.find(key);
+  if (it == index_.end())
+  {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+void SearchCache::put(const std::string &key, std::shared_ptr<const CachedSearch> value)
+{
+  if (capacity_ == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  auto it = index_.find(key);
+  if (it != index_.end())
+  {
+    it->second->second = std::move(value);
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return;
+  }
+
+  lru_.emplace_front(key, std::move(value));
+  index_[key] = lru_.begin();
+  if (lru_.size() > capacity_)
+  {
+    index_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+}
+
+void SearchCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mtx_);
+  lru_.clear();
+  index_.clear();
+}
+
+// Only slots holding a search with the same parameters are candidates
+class SimilarQueryCache::ParamsFilter : public hnswlib::BaseFilterFunctor
+{
+public:
+  ParamsFilter(const std::vector<Slot> &slots, const std::string &params) : slots_(slots), params_(params) {}
+
+  bool operator()(hnswlib::labeltype slot) override { return slots_[slot].params == params_; }
+
+private:
+  const std::vector<Slot> &slots_;
+  const std::string &params_;
+};
+
+SimilarQueryCache::SimilarQueryCache(size_t dimension, size_t capacity, float epsilon)
+    : capacity_(capacity), epsilon_(epsilon), space_(dimension)
+{
+  if (enabled())
+  {
+    index_ = std::make_unique<hnswlib::BruteforceSearch<float>>(&space_, capacity_);
+    slots_.reserve(capacity_);
+  }
+}
+
+SimilarQueryCache::Match SimilarQueryCache::find(const std::vector<float> &embedding, const std::string &params)
+{
+  Match match;
+  if (!enabled() || embedding.size() * sizeof(float) != space_.get_data_size())
+    return match;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (!slots_.empty())
+  {
+    ParamsFilter filter(slots_, params);
+    auto nearest = index_->searchKnn(embedding.data(), 1, &filter);
+    if (!nearest.empty() && nearest.top().first <= epsilon_)
+    {
+      match.slot = nearest.top().second;
+      match.value = slots_[match.slot].value;
+    }
+  }
+  (match.value ? hits_ : misses_).fetch_add(1, std::memory_order_relaxed);
+  return match;
+}
+
+void SimilarQueryCache::put(const std::string &params, std::shared_ptr<const CachedSearch> value, size_t slot)
+{
+  if (!enabled() || !value->embedding || value->embedding->size() * sizeof(float) != space_.get_data_size())
+    return;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (slot == NO_SLOT || slot >= slots_.size())
+  {
+    if (slots_.size() < capacity_)
+    {
+      slot = slots_.size();
+      slots_.emplace_back();
+    }
+    else
+    {
+      slot = next_slot_;
+      next_slot_ = (next_slot_ + 1) % capacity_;
+    }
+  }
+
+  index_->addPoint(value->embedding->data(), slot); // replaces the slot's vector if present
+  slots_[slot].params = params;
+  slots_[slot].value = std::move(value);
+}
+
+void SimilarQueryCache::clear()
+{
+  if (!enabled())
+    return;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  index_ = std::make_unique<hnswlib::BruteforceSearch<float>>(&space_, capacity_);
+  slots_.clear();
+  next_slot_ = 0;
+}
@@ -0,0 +1,176 @@
+#include "ShardedIndex.hpp"
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+// One worker per core beside the caller, shared by every store, so shard walks and
+// the queries of a batch search never add up to more threads than cores. Never
+// destroyed, so stores that outlive main() can still checkpoint through it.
+static ThreadPool *sharedPool()
+{
+  static ThreadPool *pool = []() -> ThreadPool *
+  {
+    size_t workers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    return workers == 0 ? nullptr : new ThreadPool(workers);
+  }();
+  return pool;
+}
+
+ShardedIndex::ShardedIndex(hnswlib::SpaceInterface<float> *space, size_t max_elements)
+    : space_(space), max_elements_(max_elements), pool_(sharedPool())
+{
+}
+
+void ShardedIndex::reset(size_t shards, size_t M, size_t ef_construction)
+{
+  shards = std::max<size_t>(1, shards);
+  shards_.clear();
+  shards_.resize(shards);
+  for (auto &shard : shards_)
+    shard = std::make_unique<Index>(space_, shardCapacity(), M, ef_construction);
+}
+
+// A loop's caller runs every item no worker has taken, so loops nested in one
+// another on the pool cannot wait on each other; on a single core they run in turn
+void ShardedIndex::forEach(size_t n, const std::function<void(size_t)> &f)
+{
+  if (pool_)
+  {
+    pool_->forEach(n, f);
+    return;
+  }
+  for (size_t i = 0; i < n; ++i)
+    f(i);
+}
+
+void ShardedIndex::forEachShard(const std::function<void(size_t)> &f)
+{
+  forEach(shards_.size(), f);
+}
+
+size_t ShardedIndex::shardCapacity() const
+{
+  return (max_elements_ + shards_.size() - 1) / shards_.size();
+}
+
+void ShardedIndex::addPoint(const float *vector, long id)
+{
+  shards_[shardOf(id)]->addPoint(vector, id);
+}
+
+void ShardedIndex::addPoints(const std::vector<std::pair<long, const float *>> &points)
+{
+  auto insert = [&](size_t shard)
+  {
+    for (const auto &[id, vector] : points)
+    {
+      if (shardOf(id) != shard)
+        continue;
+      try
+      {
+        shards_[shard]->addPoint(vector, id);
+      }
+      catch (const std::runtime_error &e)
+      {
+        std::cerr << "Error indexing entry " << id << ": " << e.what() << std::endl;
+      }
+    }
+  };
+  forEachShard(insert);
+}
+
+const float *ShardedIndex::find(long id) const
+{
+  const Index &shard = *shards_[shardOf(id)];
+  std::lock_guard<std::mutex> lock(shard.label_lookup_lock); // inserts may be in flight
+  auto found = shard.label_lookup_.find(id);
+  if (found == shard.label_lookup_.end())
+    return nullptr;
+  return (const float *)shard.getDataByInternalId(found->second);
+}
+
+ShardedIndex::Ranked ShardedIndex::searchKnn(const float *query, size_t k, size_t ef, hnswlib::BaseFilterFunctor *filter)
+{
+  std::vector<Ranked> parts(shards_.size());
+  auto search = [&](size_t i)
+  {
+    if (shards_[i]->cur_element_count == 0)
+      return;
+    auto top = shards_[i]->searchKnnEf(query, k, ef, filter);
+    Ranked &ranked = parts[i];
+    ranked.reserve(top.size());
+    while (!top.empty())
+    {
+      ranked.push_back(top.top());
+      top.pop();
+    }
+    std::reverse(ranked.begin(), ranked.end());
+  };
+  forEachShard(search);
+  return parts.size() == 1 ? std::move(parts[0]) : merge(parts, k);
+}
+
+ShardedIndex::Ranked ShardedIndex::searchStopCondition(const float *query, const StopFactory &make_stop, size_t limit,
+                                                       hnswlib::BaseFilterFunctor *filter)
+{
+  std::vector<Ranked> parts(shards_.size());
+  auto search = [&](size_t i)
+  {
+    auto stop = make_stop();
+    parts[i] = shards_[i]->searchStopConditionClosest(query, *stop, filter);
+  };
+  forEachShard(search);
+  return merge(parts, limit);
+}
+
+ShardedIndex::Ranked ShardedIndex::merge(const std::vector<Ranked> &parts, size_t limit)
+{
+  // (distance, part, position) of each part's nearest unmerged pair
+  using Head = std::tuple<float, size_t, size_t>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  for (size_t p = 0; p < parts.size(); ++p)
+  {
+    if (!parts[p].empty())
+      heads.emplace(parts[p][0].first, p, 0);
+  }
+
+  Ranked merged;
+  while (!heads.empty() && merged.size() < limit)
+  {
+    auto [dist, p, pos] = heads.top();
+    heads.pop();
+    merged.push_back(parts[p][pos]);
+    if (pos + 1 < parts[p].size())
+      heads.emplace(parts[p][pos + 1].first, p, pos + 1);
+  }
+  return merged;
+}
+
+size_t ShardedIndex::size() const
+{
+  size_t elements = 0;
+  for (const auto &shard : shards_)
+    elements += shard->cur_element_count;
+  return elements;
+}
+
+void ShardedIndex::clearDirty()
+{
+  for (auto &shard : shards_)
+    shard->clearDirty();
+}
+
+size_t ShardedIndex::memoryUsage() const
+{
+  size_t bytes = 0;
+  for (const auto &shard : shards_)
+  {
+    // Per element: level-0 data and links, the upper-level link pointer and a label lookup node
+    bytes += shard->cur_element_count * (shard->size_data_per_element_ + sizeof(void *) + 32) +
+             shard->max_elements_ * sizeof(std::mutex);
+  }
+  return bytes;
+}
@@ -0,0 +1,338 @@
+#include "ShmChannel.hpp"
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t alignUp(size_t n)
+{
+  return (n + 63) & ~(size_t)63;
+}
+
+static void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Busy-waiting only pays off when the other side can run at the same time
+static bool canSpin()
+{
+  static const bool multicore = std::thread::hardware_concurrency() > 1;
+  return multicore;
+}
+
+ShmRegion::~ShmRegion()
+{
+  close();
+}
+
+void ShmRegion::map(int fd, size_t size)
+{
+  void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED)
+    throw std::runtime_error("Cannot mmap shared memory channel");
+  base_ = base;
+  size_ = size;
+  header_ = static_cast<ShmHeader *>(base_);
+}
+
+void ShmRegion::layout()
+{
+  char *p = static_cast<char *>(base_);
+  slots_ = reinterpret_cast<ShmSlot *>(p + alignUp(sizeof(ShmHeader)));
+  requests_ = p + alignUp(sizeof(ShmHeader)) + alignUp(header_->slot_count * sizeof(ShmSlot));
+  arena_ = requests_ + alignUp((size_t)header_->slot_count * header_->request_capacity);
+}
+
+static size_t regionSize(uint32_t slot_count, uint32_t request_capacity, uint32_t response_capacity)
+{
+  return alignUp(sizeof(ShmHeader)) + alignUp(slot_count * sizeof(ShmSlot)) +
+         alignUp((size_t)slot_count * request_capacity) + (size_t)slot_count * response_capacity;
+}
+
+void ShmRegion::create(const std::string &name, uint32_t slot_count, uint32_t request_capacity, uint32_t response_capacity)
+{
+  close();
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+  if (fd < 0)
+    throw std::runtime_error("Cannot create shared memory channel " + name);
+
+  size_t size = regionSize(slot_count, request_capacity, response_capacity);
+  if (ftruncate(fd, size) != 0)
+  {
+    ::close(fd);
+    shm_unlink(name.c_str());
+    throw std::runtime_error("Cannot size shared memory channel " + name);
+  }
+
+  try
+  {
+    map(fd, size);
+  }
+  catch (...)
+  {
+    shm_unlink(name.c_str());
+    throw;
+  }
+  // Clients check the magic last, so write the geometry before it
+  header_ = new (base_) ShmHeader{};
+  header_->slot_count = slot_count;
+  header_->request_capacity = request_capacity;
+  header_->response_capacity = response_capacity;
+  layout();
+  for (uint32_t i = 0; i < slot_count; ++i)
+    new (&slots_[i]) ShmSlot{};
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(header_->magic, SHM_MAGIC, sizeof(header_->magic));
+}
+
+void ShmRegion::open(const std::string &name)
+{
+  close();
+  int fd = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd < 0)
+    throw std::runtime_error("Shared memory channel " + name + " does not exist");
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < alignUp(sizeof(ShmHeader)))
+  {
+    ::close(fd);
+    throw std::runtime_error("Shared memory channel " + name + " is not compatible");
+  }
+  // The header holds atomics, so it is only ever read through the mapping
+  map(fd, st.st_size);
+  const ShmHeader &h = *header_;
+  if (std::memcmp(h.magic, SHM_MAGIC, sizeof(h.magic)) != 0 ||
+      size_ != regionSize(h.slot_count, h.request_capacity, h.response_capacity))
+  {
+    close();
+    throw std::runtime_error("Shared memory channel " + name + " is not compatible");
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  layout();
+}
+
+void ShmRegion::close()
+{
+  if (base_)
+    munmap(base_, size_);
+  base_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  slots_ = nullptr;
+  requests_ = nullptr;
+  arena_ = nullptr;
+}
+
+ShmServer::ShmServer(MemoryManager &memory, const std::string &name, size_t threads, uint32_t slot_count)
+    : memory_(memory), name_(name), thread_count_(std::max<size_t>(threads, 1)), slot_count_(std::max<uint32_t>(slot_count, 1))
+{
+}
+
+ShmServer::~ShmServer()
+{
+  stop();
+}
+
+void ShmServer::start()
+{
+  region_.create(name_, slot_count_, REQUEST_CAPACITY, RESPONSE_CAPACITY);
+  region_.header().server_running.store(1, std::memory_order_release);
+  for (size_t t = 0; t < thread_count_; ++t)
+  {
+    size_t first_slot = t * slot_count_ / thread_count_;
+    threads_.emplace_back([this, first_slot]()
+                          { poll(first_slot); });
+  }
+  std::cout << "Serving shared memory channel " << name_ << " with " << thread_count_ << " threads" << std::endl;
+}
+
+void ShmServer::stop()
+{
+  if (stopping_.exchange(true))
+    return;
+  for (auto &t : threads_)
+    t.join();
+  threads_.clear();
+  if (region_.arena())
+  {
+    region_.header().server_running.store(0, std::memory_order_release);
+    shm_unlink(name_.c_str());
+    region_.close();
+  }
+}
+
+// Spins while requests keep arriving and backs off to short sleeps once idle,
+// so a busy loop costs no syscalls and an idle one little CPU
+void ShmServer::poll(size_t first_slot)
+{
+  using clock = std::chrono::steady_clock;
+  const auto spin_window = std::chrono::microseconds(200);
+  auto last_work = clock::now();
+  auto last_reclaim = last_work;
+  std::string body;
+
+  while (!stopping_.load(std::memory_order_relaxed))
+  {
+    bool worked = false;
+    for (size_t n = 0; n < slot_count_; ++n)
+    {
+      size_t i = (first_slot + n) % slot_count_;
+      ShmSlot &slot = region_.slot(i);
+      uint64_t word = slot.word.load(std::memory_order_relaxed);
+      if (ShmSlot::stateOf(word) != ShmSlot::REQUEST ||
+          !slot.word.compare_exchange_strong(word, ShmSlot::withState(word, ShmSlot::PROCESSING),
+                                             std::memory_order_acquire))
+        continue;
+      process(i, body);
+      worked = true;
+    }
+
+    if (worked)
+    {
+      last_work = clock::now();
+    }
+    else if (clock::now() - last_work < spin_window)
+    {
+      canSpin() ? cpuRelax() : std::this_thread::yield();
+    }
+    else
+    {
+      // One thread looks for slots of exited clients once a second while idle
+      if (first_slot == 0 && clock::now() - last_reclaim > std::chrono::seconds(1))
+      {
+        reclaimSlots();
+        last_reclaim = clock::now();
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+  }
+}
+
+void ShmServer::reclaimSlots()
+{
+  for (size_t i = 0; i < slot_count_; ++i)
+  {
+    ShmSlot &slot = region_.slot(i);
+    uint64_t word = slot.word.load(std::memory_order_acquire);
+    ShmSlot::State state = ShmSlot::stateOf(word);
+    // Only CLAIMED and DONE wait on the client; REQUEST is answered and then reclaimed as DONE
+    if (state != ShmSlot::CLAIMED && state != ShmSlot::DONE)
+      continue;
+    pid_t owner = ShmSlot::ownerOf(word);
+    if (owner == 0 || kill(owner, 0) == 0 || errno != ESRCH)
+      continue;
+    // Fails if the slot moved on, including to a new claim, since the load
+    if (slot.word.compare_exchange_strong(word, ShmSlot::pack(ShmSlot::FREE, ShmSlot::epochOf(word), 0),
+                                          std::memory_order_relaxed))
+      std::cerr << "Freed shared memory slot " << i << " left by exited client " << owner << std::endl;
+  }
+}
+
+void ShmServer::process(size_t i, std::string &body)
+{
+  ShmSlot &slot = region_.slot(i);
+  uint32_t length = std::min(slot.request_length, REQUEST_CAPACITY);
+
+  // The request is read in place from shared memory
+  LocalStatus status = handleLocalRequest(memory_, std::string_view(region_.request(i), length), body);
+  if (body.size() > RESPONSE_CAPACITY)
+  {
+    status = STATUS_ERROR;
+    body = "Response too large for the shared memory channel";
+  }
+
+  std::memcpy(region_.response(i), body.data(), body.size());
+  slot.status = status;
+  slot.response_offset = region_.response(i) - region_.arena();
+  slot.response_length = body.size();
+  uint64_t word = slot.word.load(std::memory_order_relaxed);
+  if (slot.word.compare_exchange_strong(word, ShmSlot::withState(word, ShmSlot::DONE), std::memory_order_release))
+    return;
+  // The client gave up and marked the slot ABANDONED; nobody will collect the answer
+  slot.word.store(ShmSlot::pack(ShmSlot::FREE, ShmSlot::epochOf(word), 0), std::memory_order_release);
+}
+
+ShmClient::ShmClient(const std::string &name) : pid_(getpid())
+{
+  region_.open(name);
+}
+
+LocalStatus ShmClient::call(std::string_view request, std::string &response, long timeout_us)
+{
+  const ShmHeader &header = region_.header();
+  if (request.size() > header.request_capacity)
+    throw std::runtime_error("Request too large for the shared memory channel");
+  if (!header.server_running.load(std::memory_order_acquire))
+    throw std::runtime_error("Shared memory server is not running");
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+  size_t i = 0;
+  uint64_t claim = 0;
+  while (claim == 0)
+  {
+    for (uint32_t n = 0; n < header.slot_count && claim == 0; ++n)
+    {
+      i = next_slot_.fetch_add(1, std::memory_order_relaxed) % header.slot_count;
+      std::atomic<uint64_t> &word = region_.slot(i).word;
+      uint64_t expected = word.load(std::memory_order_relaxed);
+      if (ShmSlot::stateOf(expected) != ShmSlot::FREE)
+        continue;
+      uint64_t claimed = ShmSlot::pack(ShmSlot::CLAIMED, ShmSlot::epochOf(expected) + 1, pid_);
+      if (word.compare_exchange_strong(expected, claimed, std::memory_order_acquire))
+        claim = claimed;
+    }
+    if (claim != 0)
+      break;
+    if (std::chrono::steady_clock::now() > deadline)
+      throw std::runtime_error("No free shared memory slot");
+    if (!header.server_running.load(std::memory_order_acquire))
+      throw std::runtime_error("Shared memory server is not running");
+    std::this_thread::yield();
+  }
+
+  ShmSlot &slot = region_.slot(i);
+  std::memcpy(region_.request(i), request.data(), request.size());
+  slot.request_length = request.size();
+  slot.word.store(ShmSlot::withState(claim, ShmSlot::REQUEST), std::memory_order_release);
+
+  uint64_t word;
+  for (unsigned spins = 0; ShmSlot::stateOf(word = slot.word.load(std::memory_order_acquire)) != ShmSlot::DONE; ++spins)
+  {
+    if (spins < 4096 && canSpin())
+    {
+      cpuRelax();
+      continue;
+    }
+    bool running = header.server_running.load(std::memory_order_acquire);
+    if (!running || std::chrono::steady_clock::now() > deadline)
+    {
+      // Withdraw the request if the server has not picked it up, or leave it to the
+      // server to free once it has answered
+      uint64_t next = ShmSlot::stateOf(word) == ShmSlot::REQUEST ? ShmSlot::pack(ShmSlot::FREE, ShmSlot::epochOf(word), 0)
+                                                                 : ShmSlot::withState(word, ShmSlot::ABANDONED);
+      if (slot.word.compare_exchange_strong(word, next, std::memory_order_relaxed))
+        throw std::runtime_error(running ? "Shared memory server did not answer" : "Shared memory server stopped");
+      continue; // the server moved the slot on meanwhile
+    }
+    std::this_thread::yield();
+  }
+
+  response.assign(region_.arena() + slot.response_offset, slot.response_length);
+  LocalStatus status = (LocalStatus)slot.status;
+  slot.word.store(ShmSlot::pack(ShmSlot::FREE, ShmSlot::epochOf(word), 0), std::memory_order_release);
+  return status;
+}
@@ -0,0 +1,239 @@
+#include "ShortTermRing.hpp"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <mutex>
+
+ShortTermRing::ShortTermRing(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1)), slots_(new Slot[capacity_])
+{
+}
+
+void ShortTermRing::push(const RecentEntry &entry)
+{
+  uint64_t pos = head_.load(std::memory_order_relaxed);
+  Slot &slot = slots_[pos % capacity_];
+
+  slot.seq.store(2 * pos + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.id.store(entry.id, std::memory_order_relaxed);
+  slot.timestamp.store(entry.timestamp, std::memory_order_relaxed);
+  slot.role.store(entry.role, std::memory_order_relaxed);
+  slot.content.store(entry.content, std::memory_order_relaxed);
+  slot.content_length.store(entry.content_length, std::memory_order_relaxed);
+  slot.json.store(entry.json, std::memory_order_relaxed);
+  slot.json_length.store(entry.json_length, std::memory_order_relaxed);
+  slot.tags.store(entry.tags, std::memory_order_relaxed);
+  slot.tags_length.store(entry.tags_length, std::memory_order_relaxed);
+  slot.seq.store(2 * pos + 2, std::memory_order_release);
+
+  head_.store(pos + 1, std::memory_order_release);
+}
+
+void ShortTermRing::clear()
+{
+  for (size_t i = 0; i < capacity_; ++i)
+    slots_[i].seq.store(0, std::memory_order_relaxed);
+  head_.store(0, std::memory_order_release);
+}
+
+std::vector<RecentEntry> ShortTermRing::snapshot(size_t n) const
+{
+  uint64_t head = head_.load(std::memory_order_acquire);
+  size_t count = std::min<uint64_t>({n, head, capacity_});
+
+  std::vector<RecentEntry> result;
+  result.reserve(count);
+  for (uint64_t pos = head; pos > head - count; --pos)
+  {
+    const Slot &slot = slots_[(pos - 1) % capacity_];
+    uint64_t expected = 2 * pos;
+    if (slot.seq.load(std::memory_order_acquire) != expected)
+      break; // overwritten by a newer entry since head was read
+
+    RecentEntry entry;
+    entry.id = slot.id.load(std::memory_order_relaxed);
+    entry.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+    entry.role = slot.role.load(std::memory_order_relaxed);
+    entry.content = slot.content.load(std::memory_order_relaxed);
+    entry.content_length = slot.content_length.load(std::memory_order_relaxed);
+    entry.json = slot.json.load(std::memory_order_relaxed);
+    entry.json_length = slot.json_length.load(std::memory_order_relaxed);
+    entry.tags = slot.tags.load(std::memory_order_relaxed);
+    entry.tags_length = slot.tags_length.load(std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != expected)
+      break;
+    result.push_back(entry);
+  }
+  std::reverse(result.begin(), result.end());
+  return result;
+}
+
+size_t ShortTermRing::size() const
+{
+  return std::min<uint64_t>(head_.load(std::memory_order_acquire), capacity_);
+}
+
+SessionRings::SessionRings(size_t capacity, size_t max_sessions, int64_t idle_seconds)
+    : capacity_(std::max<size_t>(capacity, 1)), max_sessions_(max_sessions), idle_seconds_(idle_seconds)
+{
+}
+
+SessionRings::~SessionRings()
+{
+  clear();
+}
+
+SessionRings::Shard &SessionRings::shardFor(std::string_view session)
+{
+  return shards_[std::hash<std::string_view>()(session) % SHARDS];
+}
+
+const SessionRings::Shard &SessionRings::shardFor(std::string_view session) const
+{
+  return shards_[std::hash<std::string_view>()(session) % SHARDS];
+}
+
+std::shared_ptr<SessionRings::Session> SessionRings::find(std::string_view session) const
+{
+  const Shard &shard = shardFor(session);
+  std::shared_lock<std::shared_mutex> lock(shard.mtx);
+  auto it = shard.sessions.find(std::string(session));
+  return it == shard.sessions.end() ? nullptr : it->second;
+}
+
+void SessionRings::link(Session *session)
+{
+  session->older = newest_;
+  session->newer = nullptr;
+  if (newest_)
+    newest_->newer = session;
+  newest_ = session;
+  if (!oldest_)
+    oldest_ = session;
+  session->linked = true;
+}
+
+void SessionRings::unlink(Session *session)
+{
+  (session->newer ? session->newer->older : newest_) = session->older;
+  (session->older ? session->older->newer : oldest_) = session->newer;
+  session->newer = session->older = nullptr;
+  session->linked = false;
+}
+
+void SessionRings::touch(Session *session)
+{
+  std::lock_guard<std::mutex> lock(lru_mtx_);
+  if (session->linked)
+    unlink(session);
+  link(session);
+}
+
+void SessionRings::push(std::string_view session, const RecentEntry &entry, int64_t now)
+{
+  if (!enabled())
+    return;
+  Shard &shard = shardFor(session);
+  {
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    auto it = shard.sessions.find(std::string(session));
+    if (it != shard.sessions.end())
+    {
+      Session &target = *it->second;
+      target.last_used.store(now, std::memory_order_relaxed);
+      touch(&target);
+      target.ring.push(entry);
+      return;
+    }
+  }
+
+  // Eviction takes the victim's shard lock, which may be this one. Idle sessions
+  // go first; both walks stop at the first session they keep.
+  if (count_.load(std::memory_order_relaxed) >= max_sessions_)
+  {
+    size_t dropped = evictIdle(now);
+    while (count_.load(std::memory_order_relaxed) >= max_sessions_ &&
+           evictOldest(std::numeric_limits<int64_t>::max(), dropped))
+    {
+    }
+  }
+  auto target = std::make_shared<Session>(session, capacity_);
+  target->last_used.store(now, std::memory_order_relaxed);
+  std::unique_lock<std::shared_mutex> lock(shard.mtx);
+  shard.sessions.emplace(target->name, target);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  touch(target.get());
+  target->ring.push(entry);
+}
+
+std::vector<RecentEntry> SessionRings::snapshot(std::string_view session, size_t n) const
+{
+  std::shared_ptr<Session> target = find(session);
+  return target ? target->ring.snapshot(n) : std::vector<RecentEntry>();
+}
+
+size_t SessionRings::size(std::string_view session) const
+{
+  std::shared_ptr<Session> target = find(session);
+  return target ? target->ring.size() : 0;
+}
+
+size_t SessionRings::evictIdle(int64_t now)
+{
+  size_t evicted = 0;
+  while (evictOldest(now - idle_seconds_, evicted))
+  {
+  }
+  return evicted;
+}
+
+// The victim leaves the list first, so its shard lock is taken without lru_mtx_
+// held; a push that reaches it before the erase puts it back, and it is kept.
+bool SessionRings::evictOldest(int64_t cutoff, size_t &dropped)
+{
+  std::string name;
+  Session *victim;
+  {
+    std::lock_guard<std::mutex> lock(lru_mtx_);
+    victim = oldest_;
+    if (!victim || victim->last_used.load(std::memory_order_relaxed) >= cutoff)
+      return false;
+    unlink(victim);
+    name = victim->name;
+  }
+
+  Shard &shard = shardFor(name);
+  std::unique_lock<std::shared_mutex> lock(shard.mtx);
+  auto it = shard.sessions.find(name);
+  if (it == shard.sessions.end() || it->second.get() != victim)
+    return true; // already gone
+  {
+    std::lock_guard<std::mutex> lru_lock(lru_mtx_);
+    if (victim->linked)
+      return true; // used again meanwhile
+  }
+  shard.sessions.erase(it);
+  count_.fetch_sub(1, std::memory_order_relaxed);
+  ++dropped;
+  return true;
+}
+
+void SessionRings::clear()
+{
+  for (Shard &shard : shards_)
+  {
+    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+    shard.sessions.clear();
+  }
+  std::lock_guard<std::mutex> lock(lru_mtx_);
+  newest_ = oldest_ = nullptr;
+  count_.store(0, std::memory_order_relaxed);
+}
+
+size_t SessionRings::sessions() const
+{
+  return count_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,156 @@
+#include "StoreRegistry.hpp"
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// Memory use grows with adds as well as loads, so the budget is also checked every so many gets
+static constexpr size_t TRIM_INTERVAL = 256;
+
+StoreRegistry::StoreRegistry(const std::string &model_path, const MemoryConfig &config, size_t memory_budget)
+    : config_(config), memory_budget_(memory_budget)
+{
+  model_ = std::async(std::launch::async, [model_path]() -> std::shared_ptr<LlamaEmbeddingGenerator>
+                      {
+                        try
+                        {
+                          return std::make_shared<LlamaEmbeddingGenerator>(model_path, 512);
+                        }
+                        catch (const std::exception &e)
+                        {
+                          std::cerr << "Error loading embedding model: " << e.what() << std::endl;
+                          return nullptr;
+                        } })
+               .share();
+  default_store_ = std::make_shared<MemoryManager>(model_, config_);
+  trimmer_ = std::thread([this]()
+                         { trimLoop(); });
+}
+
+StoreRegistry::~StoreRegistry()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stopping_ = true;
+  }
+  trim_cv_.notify_all();
+  trimmer_.join();
+
+  // Tenant stores checkpoint as they are destroyed
+  std::lock_guard<std::mutex> lock(mtx_);
+  index_.clear();
+  lru_.clear();
+}
+
+bool StoreRegistry::validTenant(const std::string &tenant)
+{
+  if (tenant.empty() || tenant.size() > 64)
+    return false;
+  for (char c : tenant)
+  {
+    bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+std::shared_ptr<MemoryManager> StoreRegistry::get(const std::string &tenant)
+{
+  if (tenant.empty())
+    return default_store_;
+  if (!validTenant(tenant))
+    throw std::invalid_argument("Invalid tenant: " + tenant);
+
+  std::shared_ptr<MemoryManager> store;
+  bool loaded = false;
+  bool trim = false;
+  {
+    std::unique_lock<std::mutex> lock(mtx_);
+    closed_cv_.wait(lock, [&]
+                    { return !closing_.count(tenant); });
+    auto it = index_.find(tenant);
+    if (it != index_.end())
+    {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      store = it->second->second;
+    }
+    else
+    {
+      MemoryConfig config = config_;
+      config.data_dir = (std::filesystem::path(config_.data_dir) / "tenants" / tenant).string();
+      store = std::make_shared<MemoryManager>(model_, config);
+      lru_.emplace_front(tenant, store);
+      index_[tenant] = lru_.begin();
+      loaded = true;
+    }
+    trim = loaded || ++gets_since_trim_ >= TRIM_INTERVAL;
+    if (trim)
+    {
+      gets_since_trim_ = 0;
+      trim_requested_ = true;
+    }
+  }
+  if (trim)
+    trim_cv_.notify_one();
+  return store;
+}
+
+void StoreRegistry::trimLoop()
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (true)
+  {
+    trim_cv_.wait(lock, [this]
+                  { return stopping_ || trim_requested_; });
+    if (stopping_)
+      return;
+    trim_requested_ = false;
+    lock.unlock();
+    evictOverBudget();
+    lock.lock();
+  }
+}
+
+// Runs on the trim thread. Victims are chosen from the least recently used end
+// among stores nobody else holds, and closed (which checkpoints them) here too.
+void StoreRegistry::evictOverBudget()
+{
+  std::vector<Entry> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    size_t total = default_store_->usageEstimate();
+    for (const Entry &entry : lru_)
+      total += entry.second->usageEstimate();
+
+    for (auto it = lru_.end(); it != lru_.begin() && total > memory_budget_;)
+    {
+      --it;
+      // The registry's reference is the only one: no request is using the store
+      if (it->second.use_count() > 1)
+        continue;
+      total -= std::min(total, it->second->usageEstimate());
+      closing_.insert(it->first);
+      index_.erase(it->first);
+      evicted.push_back(std::move(*it));
+      it = lru_.erase(it);
+    }
+  }
+
+  for (Entry &entry : evicted)
+  {
+    std::cout << "Closing store " << entry.first << " to stay within the memory budget." << std::endl;
+    entry.second.reset(); // checkpoints and frees the store
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      closing_.erase(entry.first);
+    }
+    closed_cv_.notify_all();
+  }
+}
+
+size_t StoreRegistry::loadedStores()
+{
+  std::lock_guard<std::mutex> lock(mtx_);
+  return lru_.size() + 1;
+}
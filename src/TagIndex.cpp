@@ -0,0 +1,252 @@
+#include "TagIndex.hpp"
+#include <algorithm>
+#include <iterator>
+
+bool TagBitmap::Container::contains(uint16_t low) const
+{
+  if (dense())
+    return (bits[low >> 6] >> (low & 63)) & 1;
+  return std::binary_search(array.begin(), array.end(), low);
+}
+
+void TagBitmap::Container::add(uint16_t low)
+{
+  if (dense())
+  {
+    uint64_t mask = (uint64_t)1 << (low & 63);
+    if (!(bits[low >> 6] & mask))
+    {
+      bits[low >> 6] |= mask;
+      ++cardinality;
+    }
+    return;
+  }
+
+  // Ids usually arrive in ascending order
+  if (array.empty() || array.back() < low)
+    array.push_back(low);
+  else
+  {
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (*it == low)
+      return;
+    array.insert(it, low);
+  }
+  ++cardinality;
+  if (array.size() > ARRAY_MAX)
+    toBitset();
+}
+
+void TagBitmap::Container::toBitset()
+{
+  bits.assign(BITSET_WORDS, 0);
+  for (uint16_t low : array)
+    bits[low >> 6] |= (uint64_t)1 << (low & 63);
+  array.clear();
+  array.shrink_to_fit();
+}
+
+void TagBitmap::Container::toArray()
+{
+  std::vector<uint16_t> lows;
+  lows.reserve(cardinality);
+  for (size_t w = 0; w < BITSET_WORDS; ++w)
+  {
+    for (uint64_t word = bits[w]; word; word &= word - 1)
+      lows.push_back(w * 64 + __builtin_ctzll(word));
+  }
+  array = std::move(lows);
+  bits.clear();
+  bits.shrink_to_fit();
+}
+
+const TagBitmap::Container *TagBitmap::find(uint16_t key) const
+{
+  auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                             [](const Container &c, uint16_t k)
+                             { return c.key < k; });
+  return it != containers_.end() && it->key == key ? &*it : nullptr;
+}
+
+void TagBitmap::add(uint32_t id)
+{
+  uint16_t key = id >> 16;
+  auto it = containers_.end();
+  if (containers_.empty() || containers_.back().key != key)
+  {
+    it = std::lower_bound(containers_.begin(), containers_.end(), key,
+                          [](const Container &c, uint16_t k)
+                          { return c.key < k; });
+    if (it == containers_.end() || it->key != key)
+    {
+      it = containers_.insert(it, Container{});
+      it->key = key;
+    }
+  }
+  else
+  {
+    it = containers_.end() - 1;
+  }
+
+  uint32_t before = it->cardinality;
+  it->add(id & 0xFFFF);
+  cardinality_ += it->cardinality - before;
+}
+
+bool TagBitmap::contains(uint32_t id) const
+{
+  const Container *c = find(id >> 16);
+  return c && c->contains(id & 0xFFFF);
+}
+
+TagBitmap::Container TagBitmap::intersect(const Container &a, const Container &b)
+{
+  Container out;
+  out.key = a.key;
+  if (a.dense() && b.dense())
+  {
+    out.bits.resize(BITSET_WORDS);
+    uint32_t count = 0;
+    for (size_t w = 0; w < BITSET_WORDS; ++w)
+    {
+      out.bits[w] = a.bits[w] & b.bits[w];
+      count += __builtin_popcountll(out.bits[w]);
+    }
+    out.cardinality = count;
+    if (count <= ARRAY_MAX)
+      out.toArray();
+    return out;
+  }
+  if (a.dense() || b.dense())
+  {
+    const Container &sparse = a.dense() ? b : a;
+    const Container &dense = a.dense() ? a : b;
+    for (uint16_t low : sparse.array)
+    {
+      if (dense.contains(low))
+        out.array.push_back(low);
+    }
+  }
+  else
+  {
+    std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+                          std::back_inserter(out.array));
+  }
+  out.cardinality = out.array.size();
+  return out;
+}
+
+void TagBitmap::unite(Container &a, const Container &b)
+{
+  if (!a.dense() && !b.dense() && a.array.size() + b.array.size() <= ARRAY_MAX)
+  {
+    std::vector<uint16_t> merged;
+    merged.reserve(a.array.size() + b.array.size());
+    std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(merged));
+    a.array = std::move(merged);
+    a.cardinality = a.array.size();
+    return;
+  }
+
+  if (!a.dense())
+    a.toBitset();
+  if (b.dense())
+  {
+    uint32_t count = 0;
+    for (size_t w = 0; w < BITSET_WORDS; ++w)
+    {
+      a.bits[w] |= b.bits[w];
+      count += __builtin_popcountll(a.bits[w]);
+    }
+    a.cardinality = count;
+  }
+  else
+  {
+    for (uint16_t low : b.array)
+      a.add(low);
+  }
+}
+
+TagBitmap &TagBitmap::operator&=(const TagBitmap &other)
+{
+  std::vector<Container> result;
+  size_t count = 0;
+  auto i = containers_.begin();
+  auto j = other.containers_.begin();
+  while (i != containers_.end() && j != other.containers_.end())
+  {
+    if (i->key < j->key)
+      ++i;
+    else if (j->key < i->key)
+      ++j;
+    else
+    {
+      Container c = intersect(*i, *j);
+      if (c.cardinality > 0)
+      {
+        count += c.cardinality;
+        result.push_back(std::move(c));
+      }
+      ++i;
+      ++j;
+    }
+  }
+  containers_ = std::move(result);
+  cardinality_ = count;
+  return *this;
+}
+
+TagBitmap &TagBitmap::operator|=(const TagBitmap &other)
+{
+  std::vector<Container> result;
+  result.reserve(containers_.size() + other.containers_.size());
+  size_t count = 0;
+  auto i = containers_.begin();
+  auto j = other.containers_.begin();
+  while (i != containers_.end() || j != other.containers_.end())
+  {
+    if (j == other.containers_.end() || (i != containers_.end() && i->key < j->key))
+      result.push_back(std::move(*i++));
+    else if (i == containers_.end() || j->key < i->key)
+      result.push_back(*j++);
+    else
+    {
+      unite(*i, *j++);
+      result.push_back(std::move(*i++));
+    }
+    count += result.back().cardinality;
+  }
+  containers_ = std::move(result);
+  cardinality_ = count;
+  return *this;
+}
+
+size_t TagBitmap::memoryUsage() const
+{
+  size_t bytes = containers_.capacity() * sizeof(Container);
+  for (const Container &c : containers_)
+    bytes += c.array.capacity() * sizeof(uint16_t) + c.bits.capacity() * sizeof(uint64_t);
+  return bytes;
+}
+
+TagBitmap &TagIndex::bitmap(std::string_view tag)
+{
+  auto it = bitmaps_.find(std::string(tag));
+  if (it == bitmaps_.end())
+    it = bitmaps_.emplace(std::string(tag), TagBitmap()).first;
+  return it->second;
+}
+
+const TagBitmap *TagIndex::find(std::string_view tag) const
+{
+  auto it = bitmaps_.find(std::string(tag));
+  return it == bitmaps_.end() ? nullptr : &it->second;
+}
+
+size_t TagIndex::memoryUsage() const
+{
+  size_t bytes = 0;
+  for (const auto &[tag, bitmap] : bitmaps_)
+    bytes += tag.capacity() + bitmap.memoryUsage();
+  return bytes;
+}
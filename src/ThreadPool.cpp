@@ -0,0 +1,93 @@
+#include "ThreadPool.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t workers)
+{
+  for (size_t i = 0; i < workers; ++i)
+    workers_.emplace_back([this]()
+                          { work(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+size_t ThreadPool::claim(Loop &loop)
+{
+  size_t i = loop.next++;
+  if (loop.next == loop.n)
+    loops_.erase(std::find(loops_.begin(), loops_.end(), &loop));
+  return i;
+}
+
+void ThreadPool::run(Loop &loop, size_t i, std::unique_lock<std::mutex> &lock)
+{
+  lock.unlock();
+  std::exception_ptr error;
+  try
+  {
+    (*loop.f)(i);
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+  }
+  lock.lock();
+  if (error && !loop.error)
+    loop.error = error;
+  // The loop lives on its caller's stack; once done reaches n it may be gone
+  if (++loop.done == loop.n)
+    done_cv_.notify_all();
+}
+
+void ThreadPool::work()
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  while (true)
+  {
+    work_cv_.wait(lock, [this]
+                  { return stop_ || !loops_.empty(); });
+    if (stop_)
+      return;
+    Loop &loop = *loops_.front();
+    run(loop, claim(loop), lock);
+  }
+}
+
+void ThreadPool::forEach(size_t n, const std::function<void(size_t)> &f)
+{
+  if (n == 0)
+    return;
+  if (n == 1 || workers_.empty())
+  {
+    for (size_t i = 0; i < n; ++i)
+      f(i);
+    return;
+  }
+
+  Loop loop{&f, n, 0, 0, nullptr};
+  std::unique_lock<std::mutex> lock(mtx_);
+  loops_.push_back(&loop);
+  if (n - 1 < workers_.size())
+  {
+    for (size_t i = 0; i < n - 1; ++i)
+      work_cv_.notify_one();
+  }
+  else
+  {
+    work_cv_.notify_all();
+  }
+  while (loop.next < loop.n)
+    run(loop, claim(loop), lock);
+  done_cv_.wait(lock, [&]
+                { return loop.done == loop.n; });
+  if (loop.error)
+    std::rethrow_exception(loop.error);
+}
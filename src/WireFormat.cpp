@@ -0,0 +1,111 @@
+#include "WireFormat.hpp"
+#include <cstring>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+static_assert(sizeof(float) == 4, "raw vector payloads are float32");
+// Raw payloads are little-endian IEEE-754 on the wire and are copied as is
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "raw float32 payloads need a little-endian host");
+
+// Matches a media type at the start of a header value or of one of its comma-separated entries
+static bool mentions(const std::string &header, const char *media_type)
+{
+  size_t length = std::strlen(media_type);
+  for (size_t pos = header.find(media_type); pos != std::string::npos; pos = header.find(media_type, pos + 1))
+  {
+    size_t start = header.find_last_not_of(' ', pos == 0 ? std::string::npos : pos - 1);
+    bool at_start = pos == 0 || start == std::string::npos || header[start] == ',';
+    char next = pos + length < header.size() ? header[pos + length] : '\0';
+    if (at_start && (next == '\0' || next == ';' || next == ',' || next == ' '))
+      return true;
+  }
+  return false;
+}
+
+static WireFormat formatFromHeader(const std::string &header)
+{
+  if (mentions(header, "application/cbor"))
+    return WireFormat::Cbor;
+  if (mentions(header, "application/msgpack") || mentions(header, "application/x-msgpack"))
+    return WireFormat::MsgPack;
+  if (mentions(header, "application/octet-stream"))
+    return WireFormat::Float32;
+  return WireFormat::Json;
+}
+
+WireFormat requestFormat(const crow::request &req)
+{
+  return formatFromHeader(req.get_header_value("Content-Type"));
+}
+
+WireFormat responseFormat(const crow::request &req, bool allow_float32)
+{
+  WireFormat format = formatFromHeader(req.get_header_value("Accept"));
+  return format == WireFormat::Float32 && !allow_float32 ? WireFormat::Json : format;
+}
+
+const char *contentType(WireFormat format)
+{
+  switch (format)
+  {
+  case WireFormat::Cbor:
+    return "application/cbor";
+  case WireFormat::MsgPack:
+    return "application/msgpack";
+  case WireFormat::Float32:
+    return "application/octet-stream";
+  default:
+    return "application/json";
+  }
+}
+
+json decodeBody(const std::string &body, WireFormat format)
+{
+  switch (format)
+  {
+  case WireFormat::Cbor:
+    return json::from_cbor(body);
+  case WireFormat::MsgPack:
+    return json::from_msgpack(body);
+  default:
+    return json::parse(body);
+  }
+}
+
+std::string encodeBody(const json &value, WireFormat format, bool pretty)
+{
+  std::string out;
+  switch (format)
+  {
+  case WireFormat::Cbor:
+    json::to_cbor(value, out);
+    return out;
+  case WireFormat::MsgPack:
+    json::to_msgpack(value, out);
+    return out;
+  default:
+    return value.dump(pretty ? 2 : -1);
+  }
+}
+
+std::vector<float> decodeFloat32(const std::string &body)
+{
+  if (body.size() % sizeof(float) != 0)
+    throw std::invalid_argument("float32 payload size is not a multiple of 4 bytes");
+  std::vector<float> values(body.size() / sizeof(float));
+  std::memcpy(values.data(), body.data(), body.size());
+  return values;
+}
+
+std::string encodeFloat32(const std::vector<float> &values)
+{
+  return std::string(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(float));
+}
+
+crow::response makeResponse(WireFormat format, std::string body)
+{
+  crow::response res(200, std::move(body));
+  res.set_header("Content-Type", contentType(format));
+  return res;
+}
@@ -25,6 +25,11 @@ LlamaEmbeddingGenerator::LlamaEmbeddingGenerator(const std::string &model_path,
   ctx_params.n_ctx = n_ctx;
   ctx_params.embeddings = true;
   ctx_params.n_batch = 512;
+  ctx_params.n_seq_max = MAX_SEQUENCES;
+  // Without a unified cache each sequence gets only n_ctx / n_seq_max cells, so a
+  // text packed alone would lose most of its context; n_batch already bounds the
+  // tokens of all sequences together
+  ctx_params.kv_unified = true;
   ctx_params.n_threads = 4;
 
   ctx_ = llama_init_from_model(model_, ctx_params);
@@ -47,15 +52,53 @@ LlamaEmbeddingGenerator::~LlamaEmbeddingGenerator()
 }
 
 std::vector<float> LlamaEmbeddingGenerator::generateEmbedding(const std::string &text) const
+{
+  return generateEmbeddings({text}).front();
+}
+
+std::vector<std::vector<float>> LlamaEmbeddingGenerator::generateEmbeddings(const std::vector<std::string> &texts) const
 {
   std::lock_guard<std::mutex> lock(generation_mutex_);
 
-  if (text.empty())
+  std::vector<std::vector<float>> embeddings(texts.size());
+  std::vector<std::vector<llama_token>> tokens(texts.size());
+  for (size_t i = 0; i < texts.size(); ++i)
+  {
+    if (texts[i].empty())
+      embeddings[i].assign(n_embd_, 0.0f);
+    else
+      tokens[i] = tokenize(texts[i]);
+  }
+
+  // Consecutive texts share an encode call while their tokens fit in one batch. A
+  // text longer than the batch is encoded on its own and fails as it did before.
+  size_t n_batch = llama_n_batch(ctx_);
+  size_t n_seq_max = llama_n_seq_max(ctx_);
+  size_t begin = 0;
+  while (begin < texts.size())
   {
-    return std::vector<float>(n_embd_, 0.0f);
+    size_t end = begin;
+    size_t n_tokens = 0;
+    size_t n_seqs = 0;
+    while (end < texts.size() &&
+           (n_seqs == 0 || (n_seqs < n_seq_max && n_tokens + tokens[end].size() <= n_batch)))
+    {
+      if (!tokens[end].empty())
+      {
+        n_tokens += tokens[end].size();
+        ++n_seqs;
+      }
+      ++end;
+    }
+    if (n_seqs > 0)
+      encode(tokens, begin, end, embeddings);
+    begin = end;
   }
+  return embeddings;
+}
 
-  // Tokenize the text
+std::vector<llama_token> LlamaEmbeddingGenerator::tokenize(const std::string &text) const
+{
   std::vector<llama_token> tokens;
   tokens.resize(text.size() + 16); // Reserve some extra space
 
@@ -88,19 +131,36 @@ std::vector<float> LlamaEmbeddingGenerator::generateEmbedding(const std::string
   }
 
   tokens.resize(n_tokens);
+  return tokens;
+}
+
+void LlamaEmbeddingGenerator::encode(const std::vector<std::vector<llama_token>> &tokens, size_t begin, size_t end,
+                                     std::vector<std::vector<float>> &embeddings) const
+{
+  int n_tokens = 0;
+  for (size_t i = begin; i < end; ++i)
+    n_tokens += tokens[i].size();
 
   // Create batch
   llama_batch batch = llama_batch_init(n_tokens, 0, 1);
 
-  for (int i = 0; i < n_tokens; i++)
+  llama_seq_id seq = 0;
+  for (size_t i = begin; i < end; ++i)
   {
-    batch.token[i] = tokens[i];
-    batch.pos[i] = i;
-    batch.n_seq_id[i] = 1;
-    batch.seq_id[i][0] = 0;
-    batch.logits[i] = true;
+    if (tokens[i].empty())
+      continue;
+    for (size_t pos = 0; pos < tokens[i].size(); ++pos)
+    {
+      int t = batch.n_tokens++;
+      batch.token[t] = tokens[i][pos];
+      batch.pos[t] = pos;
+      batch.n_seq_id[t] = 1;
+      batch.seq_id[t][0] = seq;
+      batch.logits[t] = true;
+    }
+    ++seq;
   }
-  batch.n_tokens = n_tokens;
+  llama_seq_id n_seqs = seq;
 
   if (llama_encode(ctx_, batch) != 0)
   {
@@ -108,31 +168,37 @@ std::vector<float> LlamaEmbeddingGenerator::generateEmbedding(const std::string
     throw std::runtime_error("Failed to encode tokens");
   }
 
-  const float *embeddings = llama_get_embeddings_seq(ctx_, 0);
-  if (!embeddings)
+  seq = 0;
+  for (size_t i = begin; i < end; ++i)
   {
-    embeddings = llama_get_embeddings(ctx_);
-    if (!embeddings)
+    if (tokens[i].empty())
+      continue;
+    const float *output = llama_get_embeddings_seq(ctx_, seq);
+    // Without pooling there are only per-token embeddings; a lone sequence uses the first
+    if (!output && n_seqs == 1)
+      output = llama_get_embeddings(ctx_);
+    if (!output)
     {
       llama_batch_free(batch);
       throw std::runtime_error("Failed to get embeddings from context");
     }
-  }
+    ++seq;
 
-  std::vector<float> embedding(embeddings, embeddings + n_embd_);
+    std::vector<float> embedding(output, output + n_embd_);
 
-  // Normalize the embedding vector
-  float norm = 0.0f;
-  for (float v : embedding)
-    norm += v * v;
-  norm = std::sqrt(norm);
+    // Normalize the embedding vector
+    float norm = 0.0f;
+    for (float v : embedding)
+      norm += v * v;
+    norm = std::sqrt(norm);
 
-  if (norm > 1e-12f)
-  {
-    for (float &v : embedding)
-      v /= norm;
+    if (norm > 1e-12f)
+    {
+      for (float &v : embedding)
+        v /= norm;
+    }
+    embeddings[i] = std::move(embedding);
   }
 
   llama_batch_free(batch);
-  return embedding;
-}
\ No newline at end of file
+}
@@ -1,12 +1,219 @@
 #include "crow.h"
 #include "MemoryManager.hpp"
+#include "StoreRegistry.hpp"
+#include "RequestParser.hpp"
+#include "WireFormat.hpp"
+#include "LocalServer.hpp"
+#include "ShmChannel.hpp"
 #include <nlohmann/json.hpp>
 #include <iostream>
+#include <cstdlib>
+#include <algorithm>
 
 using json = nlohmann::json;
 
 const std::string MODEL_PATH = "./nomic-embed-text-v2-moe.f32.gguf";
 
+// Reads an optional setting from the environment, e.g. MEMORY_MMAP_INDEX=0
+static long envOr(const char *name, long fallback)
+{
+  const char *value = std::getenv(name);
+  if (!value || !*value)
+    return fallback;
+  try
+  {
+    return std::stol(value);
+  }
+  catch (const std::exception &)
+  {
+    std::cerr << "Ignoring invalid " << name << "=" << value << std::endl;
+    return fallback;
+  }
+}
+
+static double envOrDouble(const char *name, double fallback)
+{
+  const char *value = std::getenv(name);
+  if (!value || !*value)
+    return fallback;
+  try
+  {
+    return std::stod(value);
+  }
+  catch (const std::exception &)
+  {
+    std::cerr << "Ignoring invalid " << name << "=" << value << std::endl;
+    return fallback;
+  }
+}
+
+static std::string envOr(const char *name, const std::string &fallback)
+{
+  const char *value = std::getenv(name);
+  return value && *value ? value : fallback;
+}
+
+// Responses are compact unless the client asks for ?pretty=1
+static bool wantsPretty(const crow::request &req)
+{
+  const char *value = req.url_params.get("pretty");
+  return value && std::string(value) != "0" && std::string(value) != "false";
+}
+
+// Reads an optional integer parameter; false if it is present but not an integer of at least min
+static bool parseAtLeast(const crow::request &req, const char *name, int min, int &value)
+{
+  if (!req.url_params.get(name))
+    return true;
+  try
+  {
+    value = std::stoi(req.url_params.get(name));
+  }
+  catch (const std::exception &)
+  {
+    return false;
+  }
+  return value >= min;
+}
+
+static bool parsePositive(const crow::request &req, const char *name, int &value)
+{
+  return parseAtLeast(req, name, 1, value);
+}
+
+// Reads an optional time bound, either ISO-8601 UTC or seconds since the epoch
+static bool parseTime(const crow::request &req, const char *name, int64_t &value)
+{
+  const char *text = req.url_params.get(name);
+  if (!text)
+    return true;
+  std::string s = text;
+  if (!s.empty() && std::all_of(s.begin(), s.end(), [](char c)
+                                { return c >= '0' && c <= '9'; }))
+  {
+    try
+    {
+      value = std::stoll(s);
+      return true;
+    }
+    catch (const std::exception &)
+    {
+      return false;
+    }
+  }
+  value = parseTimestamp(s);
+  return value != 0;
+}
+
+// Reads an optional id bound; false if it is present but not a non-negative integer
+static bool parseId(const crow::request &req, const char *name, long &value)
+{
+  const char *text = req.url_params.get(name);
+  if (!text)
+    return true;
+  try
+  {
+    size_t used = 0;
+    value = std::stol(text, &used);
+    return used == std::string(text).size() && value >= 0;
+  }
+  catch (const std::exception &)
+  {
+    return false;
+  }
+}
+
+// Reads an optional comma-separated tag list
+static bool parseTags(const crow::request &req, const char *name, std::vector<std::string> &tags)
+{
+  const char *text = req.url_params.get(name);
+  if (!text)
+    return true;
+  std::string_view list = text;
+  while (true)
+  {
+    size_t comma = list.find(',');
+    tags.emplace_back(list.substr(0, comma));
+    if (comma == std::string_view::npos)
+      break;
+    list.remove_prefix(comma + 1);
+  }
+  return validTags(tags);
+}
+
+// Reads ef, the filters and the range-search parameters shared by the search routes.
+// Returns an error message, or an empty string if the parameters are valid.
+static std::string parseSearchOptions(const crow::request &req, SearchOptions &options)
+{
+  static constexpr int MAX_RANGE_RESULTS = 1000;
+
+  int ef = 0;
+  if (!parsePositive(req, "ef", ef))
+    return "Invalid 'ef' parameter: must be a positive integer";
+  options.ef = ef;
+
+  SearchFilter &filter = options.filter;
+  if (const char *role = req.url_params.get("role"))
+    filter.role = role;
+  if (!parseTags(req, "tags", filter.tags))
+    return "Invalid 'tags' parameter: must be a comma-separated list of tags";
+  if (!parseTags(req, "any_tags", filter.any_tags))
+    return "Invalid 'any_tags' parameter: must be a comma-separated list of tags";
+  if (!parseTime(req, "since", filter.since))
+    return "Invalid 'since' parameter: must be an ISO-8601 UTC time or epoch seconds";
+  if (!parseTime(req, "until", filter.until))
+    return "Invalid 'until' parameter: must be an ISO-8601 UTC time or epoch seconds";
+  if (!parseId(req, "min_id", filter.min_id))
+    return "Invalid 'min_id' parameter: must be a non-negative integer";
+  if (!parseId(req, "max_id", filter.max_id))
+    return "Invalid 'max_id' parameter: must be a non-negative integer";
+
+  // max_distance switches to range search
+  const char *max_distance = req.url_params.get("max_distance");
+  if (!max_distance)
+    return {};
+  options.range = true;
+  try
+  {
+    options.max_distance = std::stof(max_distance);
+  }
+  catch (const std::exception &)
+  {
+    return "Invalid 'max_distance' parameter: must be a number";
+  }
+  if (!(options.max_distance >= 0.0f && options.max_distance <= 2.0f))
+    return "Invalid 'max_distance' parameter: must be between 0 and 2";
+
+  int min_results = 0;
+  int max_results = options.max_results;
+  if (!parseAtLeast(req, "min_results", 0, min_results))
+    return "Invalid 'min_results' parameter: must be a non-negative integer";
+  if (!parsePositive(req, "max_results", max_results) || max_results > MAX_RANGE_RESULTS)
+    return "Invalid 'max_results' parameter: must be between 1 and " + std::to_string(MAX_RANGE_RESULTS);
+  if (min_results > max_results)
+    return "Invalid 'min_results' parameter: must not exceed 'max_results'";
+  options.min_results = min_results;
+  options.max_results = max_results;
+  return {};
+}
+
+static crow::response badRequest(const std::string &message)
+{
+  return crow::response(400, json{{"status", "error"}, {"message", message}}.dump());
+}
+
+static const char *INVALID_TENANT = "Invalid tenant: must be 1 to 64 characters from A-Z, a-z, 0-9, '_' and '-'";
+
+// The store named by ?tenant= or the X-Tenant header, or the default store if
+// neither is given; nullptr if the name is invalid
+static std::shared_ptr<MemoryManager> storeFor(StoreRegistry &stores, const crow::request &req)
+{
+  std::string tenant = req.url_params.get("tenant") ? req.url_params.get("tenant") : req.get_header_value("X-Tenant");
+  if (!tenant.empty() && !StoreRegistry::validTenant(tenant))
+    return nullptr;
+  return stores.get(tenant);
+}
+
 // --------- Auth Middleware -----------
 struct AuthMiddleware
 {
@@ -31,27 +238,88 @@ struct AuthMiddleware
 int main()
 {
   crow::App<AuthMiddleware> app;
-  MemoryManager mem(MODEL_PATH, 768);
+
+  MemoryConfig config;
+  config.data_dir = envOr("MEMORY_DATA_DIR", config.data_dir);
+  config.dimension = 768;
+  config.max_elements = envOr("MEMORY_MAX_ELEMENTS", config.max_elements);
+  config.index_shards = std::max(1L, envOr("MEMORY_INDEX_SHARDS", (long)config.index_shards));
+  config.mmap_index = envOr("MEMORY_MMAP_INDEX", config.mmap_index) != 0;
+  config.verify_checksums = envOr("MEMORY_VERIFY_CHECKSUMS", config.verify_checksums) != 0;
+  config.short_term_capacity = std::max(1L, envOr("MEMORY_SHORT_TERM_CAPACITY", (long)config.short_term_capacity));
+  config.fresh_capacity = std::max(0L, envOr("MEMORY_FRESH_CAPACITY", (long)config.fresh_capacity));
+  config.max_sessions = std::max(0L, envOr("MEMORY_MAX_SESSIONS", (long)config.max_sessions));
+  config.session_idle_seconds = std::max(1L, envOr("MEMORY_SESSION_IDLE_SECONDS", (long)config.session_idle_seconds));
+  config.result_cache_size = std::max(0L, envOr("MEMORY_RESULT_CACHE_SIZE", (long)config.result_cache_size));
+  config.query_cache_size = std::max(0L, envOr("MEMORY_QUERY_CACHE_SIZE", (long)config.query_cache_size));
+  config.query_cache_epsilon = std::max(0.0, envOrDouble("MEMORY_QUERY_CACHE_EPSILON", config.query_cache_epsilon));
+  // Tenant stores share the model and are closed least recently used first beyond this budget
+  size_t budget = std::max(1L, envOr("MEMORY_STORE_BUDGET_MB", 2048L)) * (size_t)1024 * 1024;
+  StoreRegistry stores(MODEL_PATH, config, budget);
+  MemoryManager &mem = stores.defaultStore();
 
   // POST /memory/add
-  CROW_ROUTE(app, "/memory/add").methods("POST"_method)([&mem](const crow::request &req)
+  CROW_ROUTE(app, "/memory/add").methods("POST"_method)([&stores](const crow::request &req)
                                                         {
+        if (!stores.defaultStore().isSearchReady()) {
+            return crow::response(503, R"({"status":"error","message":"Server is starting up"})");
+        }
+        std::shared_ptr<MemoryManager> mem = storeFor(stores, req);
+        if (!mem) {
+            return badRequest(INVALID_TENANT);
+        }
         try {
-            auto body = json::parse(req.body);
-            if (!body.is_object() || !body.contains("role") || !body["role"].is_string() ||
-                !body.contains("content") || !body["content"].is_string()) {
-                return crow::response(400, R"({"status":"error","message":"Invalid request body: 'role' and 'content' required"})");
+            AddRequest body;
+            WireFormat format = requestFormat(req);
+            bool valid = false;
+            if (format == WireFormat::Json) {
+                valid = parseAddRequest(req.body, body);
+            } else if (format != WireFormat::Float32) {
+                json doc = decodeBody(req.body, format);
+                valid = doc.is_object() && doc.contains("role") && doc["role"].is_string() &&
+                        doc.contains("content") && doc["content"].is_string();
+                if (valid) {
+                    body.role = doc["role"].get<std::string>();
+                    body.content = doc["content"].get<std::string>();
+                }
+                if (valid && doc.contains("tags")) {
+                    valid = doc["tags"].is_array() &&
+                            std::all_of(doc["tags"].begin(), doc["tags"].end(), [](const json &tag)
+                                        { return tag.is_string(); });
+                    if (valid) {
+                        body.tags = doc["tags"].get<std::vector<std::string>>();
+                        valid = validTags(body.tags);
+                    }
+                }
+                if (valid && doc.contains("session")) {
+                    valid = doc["session"].is_string();
+                    if (valid) {
+                        body.session = doc["session"].get<std::string>();
+                        valid = body.session.empty() || validSession(body.session);
+                    }
+                }
+            }
+            if (!valid) {
+                return crow::response(400, R"({"status":"error","message":"Invalid request body: 'role' and 'content' required, 'tags' must be an array of tags, 'session' a string of at most 256 bytes"})");
             }
-            mem.add(body["role"], body["content"]);
+            mem->add(body.role, body.content, body.tags, body.session);
             return crow::response(200, R"({"status":"success","message":"Memory entry added"})");
         } catch (const std::exception& e) {
             std::cerr << "Error in /memory/add: " << e.what() << std::endl;
             return crow::response(400, R"({"status":"error","message":"Invalid JSON"})");
         } });
 
-  // GET /memory/retrieve/recent?last=N
-  CROW_ROUTE(app, "/memory/retrieve/recent").methods("GET"_method)([&mem](const crow::request &req)
+  // GET /memory/retrieve/recent?last=N[&session=...]
+  CROW_ROUTE(app, "/memory/retrieve/recent").methods("GET"_method)([&stores](const crow::request &req)
                                                                    {
+        if (!stores.defaultStore().isMetadataReady()) {
+            return crow::response(503, R"({"status":"error","message":"Server is starting up"})");
+        }
+        std::shared_ptr<MemoryManager> mem = storeFor(stores, req);
+        if (!mem) {
+            return badRequest(INVALID_TENANT);
+        }
+        std::string session = req.url_params.get("session") ? req.url_params.get("session") : "";
         int last = 0;
         if (req.url_params.get("last")) {
             try {
@@ -61,14 +329,58 @@ int main()
                 return crow::response(400, R"({"status":"error","message":"Invalid 'last' parameter: must be an integer"})");
             }
         } else {
-            last = mem.getShortTermSize();
+            last = mem->getShortTermSize(session);
         }
-        auto entries = mem.getLastN(last);
-        return crow::response(json(entries).dump(2)); });
+        WireFormat format = responseFormat(req);
+        if (format == WireFormat::Json) {
+            return makeResponse(format, mem->getLastNJson(last, wantsPretty(req), session));
+        }
+        return makeResponse(format, encodeBody(json(mem->getLastN(last, session)), format)); });
 
-  // GET /memory/retrieve/semantic?query=...&k=...
-  CROW_ROUTE(app, "/memory/retrieve/semantic").methods("GET"_method)([&mem](const crow::request &req)
+  // GET /memory/retrieve/range?[from=...][&to=...][&limit=N][&cursor=...]
+  CROW_ROUTE(app, "/memory/retrieve/range").methods("GET"_method)([&stores](const crow::request &req)
+                                                                  {
+        if (!stores.defaultStore().isMetadataReady()) {
+            return crow::response(503, R"({"status":"error","message":"Server is starting up"})");
+        }
+        std::shared_ptr<MemoryManager> mem = storeFor(stores, req);
+        if (!mem) {
+            return badRequest(INVALID_TENANT);
+        }
+        TimeRange range;
+        if (!parseTime(req, "from", range.from) || !parseTime(req, "to", range.to)) {
+            return badRequest("Invalid 'from' or 'to' parameter: must be ISO-8601 UTC or epoch seconds");
+        }
+        int limit = (int)range.limit;
+        if (!parsePositive(req, "limit", limit) || limit > 1000) {
+            return badRequest("Invalid 'limit' parameter: must be an integer from 1 to 1000");
+        }
+        range.limit = limit;
+        if (!parseId(req, "cursor", range.cursor)) {
+            return badRequest("Invalid 'cursor' parameter");
+        }
+
+        WireFormat format = responseFormat(req);
+        if (format == WireFormat::Json) {
+            return makeResponse(format, mem->getRangeJson(range, wantsPretty(req)));
+        }
+        long next_cursor = -1;
+        json body = {{"memories", mem->getRange(range, next_cursor)}};
+        body["next_cursor"] = next_cursor < 0 ? json(nullptr) : json(next_cursor);
+        return makeResponse(format, encodeBody(body, format)); });
+
+  // GET /memory/retrieve/semantic?query=...&k=...[&ef=...]
+  // Range search: ...&max_distance=...[&min_results=...][&max_results=...]
+  // Filters: [&role=...][&tags=a,b][&any_tags=c,d][&since=...][&until=...][&min_id=...][&max_id=...]
+  CROW_ROUTE(app, "/memory/retrieve/semantic").methods("GET"_method)([&stores](const crow::request &req)
                                                                      {
+        if (!stores.defaultStore().isSearchReady()) {
+            return crow::response(503, R"({"status":"error","message":"Server is starting up"})");
+        }
+        std::shared_ptr<MemoryManager> mem = storeFor(stores, req);
+        if (!mem) {
+            return badRequest(INVALID_TENANT);
+        }
         std::string query_text;
         int k = 5; // Default value
         if (req.url_params.get("query")) {
@@ -76,17 +388,168 @@ int main()
         } else {
             return crow::response(400, R"({"status":"error","message":"Missing 'query' parameter"})");
         }
-        if (req.url_params.get("k")) {
-            try {
-                k = std::stoi(req.url_params.get("k"));
-                if (k < 1) throw std::invalid_argument("invalid k");
-            } catch (const std::exception&) {
-                return crow::response(400, R"({"status":"error","message":"Invalid 'k' parameter: must be a positive integer"})");
+        if (!parsePositive(req, "k", k)) {
+            return crow::response(400, R"({"status":"error","message":"Invalid 'k' parameter: must be a positive integer"})");
+        }
+        SearchOptions options;
+        std::string error = parseSearchOptions(req, options);
+        if (!error.empty()) {
+            return badRequest(error);
+        }
+
+        WireFormat format = responseFormat(req);
+        if (format == WireFormat::Json) {
+            return makeResponse(format, mem->getRelevantMemoriesJson(query_text, k, wantsPretty(req), options));
+        }
+        return makeResponse(format, encodeBody(json(mem->getRelevantMemories(query_text, k, options)), format)); });
+
+  // POST /memory/retrieve/semantic/batch?k=...; takes the same ef, range and filter parameters as semantic search
+  // Body: {"queries":["...", ...]}. Returns one array of results per query, in order.
+  CROW_ROUTE(app, "/memory/retrieve/semantic/batch").methods("POST"_method)([&stores](const crow::request &req)
+                                                                           {
+        static constexpr size_t MAX_BATCH_QUERIES = 64;
+        if (!stores.defaultStore().isSearchReady()) {
+            return crow::response(503, R"({"status":"error","message":"Server is starting up"})");
+        }
+        std::shared_ptr<MemoryManager> mem = storeFor(stores, req);
+        if (!mem) {
+            return badRequest(INVALID_TENANT);
+        }
+        int k = 5;
+        if (!parsePositive(req, "k", k)) {
+            return crow::response(400, R"({"status":"error","message":"Invalid 'k' parameter: must be a positive integer"})");
+        }
+        SearchOptions options;
+        std::string error = parseSearchOptions(req, options);
+        if (!error.empty()) {
+            return badRequest(error);
+        }
+        std::vector<std::string> queries;
+        try {
+            json doc = decodeBody(req.body, requestFormat(req));
+            if (!doc.is_object() || !doc.contains("queries") || !doc["queries"].is_array()) {
+                return crow::response(400, R"({"status":"error","message":"Invalid request body: 'queries' required"})");
             }
+            queries = doc["queries"].get<std::vector<std::string>>();
+        } catch (const std::exception& e) {
+            return crow::response(400, R"({"status":"error","message":"Invalid request body: 'queries' must be an array of strings"})");
         }
+        if (queries.empty() || queries.size() > MAX_BATCH_QUERIES) {
+            return badRequest("Invalid 'queries': must hold 1 to " + std::to_string(MAX_BATCH_QUERIES) + " queries");
+        }
+
+        WireFormat format = responseFormat(req);
+        if (format == WireFormat::Json) {
+            return makeResponse(format, mem->getRelevantMemoriesBatchJson(queries, k, wantsPretty(req), options));
+        }
+        return makeResponse(format, encodeBody(json(mem->getRelevantMemoriesBatch(queries, k, options)), format)); });
 
-        auto entries = mem.getRelevantMemories(query_text, k);
-        return crow::response(json(entries).dump(2)); });
+  // POST /memory/retrieve/vector?k=...; takes the same ef, range and filter parameters as semantic search
+  // Body: a query embedding, either raw float32 (application/octet-stream) or {"vector":[...]}
+  CROW_ROUTE(app, "/memory/retrieve/vector").methods("POST"_method)([&stores](const crow::request &req)
+                                                                    {
+        if (!stores.defaultStore().isSearchReady()) {
+            return crow::response(503, R"({"status":"error","message":"Server is starting up"})");
+        }
+        std::shared_ptr<MemoryManager> mem = storeFor(stores, req);
+        if (!mem) {
+            return badRequest(INVALID_TENANT);
+        }
+        int k = 5;
+        if (!parsePositive(req, "k", k)) {
+            return crow::response(400, R"({"status":"error","message":"Invalid 'k' parameter: must be a positive integer"})");
+        }
+        SearchOptions options;
+        std::string error = parseSearchOptions(req, options);
+        if (!error.empty()) {
+            return badRequest(error);
+        }
+        std::vector<float> vector;
+        try {
+            WireFormat format = requestFormat(req);
+            if (format == WireFormat::Float32) {
+                vector = decodeFloat32(req.body);
+            } else {
+                json doc = decodeBody(req.body, format);
+                if (!doc.is_object() || !doc.contains("vector") || !doc["vector"].is_array()) {
+                    return crow::response(400, R"({"status":"error","message":"Invalid request body: 'vector' required"})");
+                }
+                vector = doc["vector"].get<std::vector<float>>();
+            }
+        } catch (const std::exception& e) {
+            return crow::response(400, R"({"status":"error","message":"Invalid request body"})");
+        }
+        if (vector.size() != (size_t)mem->getDimension()) {
+            return crow::response(400, R"({"status":"error","message":"Vector has the wrong dimension"})");
+        }
+
+        WireFormat format = responseFormat(req);
+        if (format == WireFormat::Json) {
+            return makeResponse(format, mem->getRelevantMemoriesByVectorJson(std::move(vector), k, wantsPretty(req), options));
+        }
+        return makeResponse(format, encodeBody(json(mem->getRelevantMemoriesByVector(std::move(vector), k, options)), format)); });
+
+  // GET /memory/embed?text=...&type=query|document
+  // Returns {"embedding":[...]}, or raw float32 with Accept: application/octet-stream
+  CROW_ROUTE(app, "/memory/embed").methods("GET"_method)([&stores](const crow::request &req)
+                                                         {
+        if (!stores.defaultStore().isSearchReady()) {
+            return crow::response(503, R"({"status":"error","message":"Server is starting up"})");
+        }
+        if (!req.url_params.get("text")) {
+            return crow::response(400, R"({"status":"error","message":"Missing 'text' parameter"})");
+        }
+        std::string type = req.url_params.get("type") ? req.url_params.get("type") : "query";
+        if (type != "query" && type != "document") {
+            return crow::response(400, R"({"status":"error","message":"Invalid 'type' parameter: must be 'query' or 'document'"})");
+        }
+        std::vector<float> embedding;
+        try {
+            embedding = stores.defaultStore().embed(req.url_params.get("text"), type == "query" ? TaskType::Query : TaskType::Document);
+        } catch (const std::exception& e) {
+            std::cerr << "Error in /memory/embed: " << e.what() << std::endl;
+            return crow::response(500, R"({"status":"error","message":"Embedding failed"})");
+        }
+
+        WireFormat format = responseFormat(req, true);
+        if (format == WireFormat::Float32) {
+            return makeResponse(format, encodeFloat32(embedding));
+        }
+        return makeResponse(format, encodeBody(json{{"embedding", embedding}}, format, wantsPretty(req))); });
+
+  // Optional Unix socket for clients on the same host, e.g. MEMORY_SOCKET_PATH=/run/jarvis/memory.sock
+  std::unique_ptr<LocalServer> local_server;
+  std::string socket_path = envOr("MEMORY_SOCKET_PATH", std::string());
+  if (!socket_path.empty())
+  {
+    local_server = std::make_unique<LocalServer>(mem, socket_path);
+    try
+    {
+      local_server->start();
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "Unix socket disabled: " << e.what() << std::endl;
+      local_server.reset();
+    }
+  }
+
+  // Optional shared-memory channel, e.g. MEMORY_SHM_NAME=/jarvis-memory
+  std::unique_ptr<ShmServer> shm_server;
+  std::string shm_name = envOr("MEMORY_SHM_NAME", std::string());
+  if (!shm_name.empty())
+  {
+    shm_server = std::make_unique<ShmServer>(mem, shm_name, std::max(1L, envOr("MEMORY_SHM_THREADS", 1L)));
+    try
+    {
+      shm_server->start();
+    }
+    catch (const std::exception &e)
+    {
+      std::cerr << "Shared memory channel disabled: " << e.what() << std::endl;
+      shm_server.reset();
+    }
+  }
 
   app.port(9004).multithreaded().run();
 }
@@ -0,0 +1,157 @@
+#include "memory_c.h"
+#include "MemoryManager.hpp"
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct jmem_store
+{
+    std::unique_ptr<MemoryManager> memory;
+};
+
+static thread_local std::string last_error;
+
+static int fail(int code, const std::string &message)
+{
+  last_error = message;
+  return code;
+}
+
+// Runs an API call, turning exceptions into error codes
+template <typename F>
+static int guarded(F &&call)
+{
+  try
+  {
+    call();
+    return JMEM_OK;
+  }
+  catch (const std::exception &e)
+  {
+    return fail(JMEM_ERR_RUNTIME, e.what());
+  }
+}
+
+static size_t copyViews(const std::vector<MemoryView> &views, jmem_entry *out, size_t capacity)
+{
+  size_t count = std::min(views.size(), capacity);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const MemoryView &v = views[i];
+    out[i] = jmem_entry{v.id, v.timestamp, v.role.data(), v.role.size(), v.content.data(), v.content.size()};
+  }
+  return count;
+}
+
+void jmem_config_init(jmem_config *config)
+{
+  MemoryConfig defaults;
+  config->data_dir = ".";
+  config->max_elements = defaults.max_elements;
+  config->mmap_index = defaults.mmap_index;
+  config->verify_checksums = defaults.verify_checksums;
+  config->short_term_capacity = defaults.short_term_capacity;
+}
+
+jmem_store *jmem_open(const char *model_path, const jmem_config *config)
+{
+  if (!model_path)
+  {
+    fail(JMEM_ERR_INVALID_ARGUMENT, "model_path is NULL");
+    return nullptr;
+  }
+
+  MemoryConfig memory_config;
+  if (config)
+  {
+    memory_config.data_dir = config->data_dir ? config->data_dir : ".";
+    memory_config.max_elements = config->max_elements;
+    memory_config.mmap_index = config->mmap_index != 0;
+    memory_config.verify_checksums = config->verify_checksums != 0;
+    memory_config.short_term_capacity = std::max<size_t>(config->short_term_capacity, 1);
+  }
+
+  try
+  {
+    auto store = std::make_unique<jmem_store>();
+    store->memory = std::make_unique<MemoryManager>(model_path, memory_config);
+    return store.release();
+  }
+  catch (const std::exception &e)
+  {
+    fail(JMEM_ERR_RUNTIME, e.what());
+    return nullptr;
+  }
+}
+
+void jmem_close(jmem_store *store)
+{
+  delete store;
+}
+
+int jmem_add(jmem_store *store, const char *role, size_t role_length, const char *content,
+             size_t content_length)
+{
+  if (!store || (!role && role_length) || (!content && content_length))
+    return fail(JMEM_ERR_INVALID_ARGUMENT, "invalid argument to jmem_add");
+  return guarded([&]
+                 { store->memory->add(std::string(role, role_length), std::string(content, content_length)); });
+}
+
+int jmem_add_batch(jmem_store *store, const jmem_input *inputs, size_t count)
+{
+  if (!store || (!inputs && count))
+    return fail(JMEM_ERR_INVALID_ARGUMENT, "invalid argument to jmem_add_batch");
+  std::vector<MemoryInput> batch;
+  batch.reserve(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    const jmem_input &input = inputs[i];
+    if ((!input.role && input.role_length) || (!input.content && input.content_length))
+      return fail(JMEM_ERR_INVALID_ARGUMENT, "invalid input " + std::to_string(i) + " to jmem_add_batch");
+    batch.push_back(MemoryInput{std::string(input.role, input.role_length),
+                                std::string(input.content, input.content_length), {}});
+  }
+  return guarded([&]
+                 { store->memory->addBatch(batch); });
+}
+
+int jmem_search(jmem_store *store, const char *query, size_t query_length, size_t k, jmem_entry *out,
+                size_t capacity, size_t *count)
+{
+  if (!store || !query || !count || (!out && capacity) || k == 0 || k > INT_MAX)
+    return fail(JMEM_ERR_INVALID_ARGUMENT, "invalid argument to jmem_search");
+  return guarded([&]
+                 { *count = copyViews(store->memory->getRelevantMemoryViews(std::string(query, query_length), k), out, capacity); });
+}
+
+int jmem_search_vector(jmem_store *store, const float *vector, size_t dimension, size_t k, jmem_entry *out,
+                       size_t capacity, size_t *count)
+{
+  if (!store || !vector || !count || (!out && capacity) || k == 0 || k > INT_MAX)
+    return fail(JMEM_ERR_INVALID_ARGUMENT, "invalid argument to jmem_search_vector");
+  if (dimension != (size_t)store->memory->getDimension())
+    return fail(JMEM_ERR_INVALID_ARGUMENT, "vector has the wrong dimension");
+  return guarded([&]
+                 { *count = copyViews(store->memory->getRelevantMemoryViewsByVector(std::vector<float>(vector, vector + dimension), k), out, capacity); });
+}
+
+int jmem_recent(jmem_store *store, size_t n, jmem_entry *out, size_t capacity, size_t *count)
+{
+  if (!store || !count || (!out && capacity))
+    return fail(JMEM_ERR_INVALID_ARGUMENT, "invalid argument to jmem_recent");
+  return guarded([&]
+                 { *count = copyViews(store->memory->getLastNViews(std::min<size_t>({n, capacity, INT_MAX})), out, capacity); });
+}
+
+size_t jmem_dimension(const jmem_store *store)
+{
+  return store ? store->memory->getDimension() : 0;
+}
+
+const char *jmem_last_error(void)
+{
+  return last_error.c_str();
+}
@@ -0,0 +1,177 @@
+// Regression tests for EntryStore loading a saved metadata file. Build and run from
+// the repository root:
+//
+//   g++ -std=c++17 -I ./include tests/EntryStoreTest.cpp src/EntryStore.cpp src/MetadataStore.cpp
+//       src/TagIndex.cpp src/JsonWriter.cpp -o build/entry_store_test && ./build/entry_store_test
+#include "EntryStore.hpp"
+#include "MetadataStore.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                              \
+  do                                                                             \
+  {                                                                              \
+    if (!(cond))                                                                 \
+    {                                                                            \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed\n"; \
+      ++failures;                                                                \
+    }                                                                            \
+  } while (0)
+
+static std::string tempPath()
+{
+  char path[] = "/tmp/entry_store_test.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0)
+  {
+    std::perror("mkstemp");
+    std::exit(1);
+  }
+  close(fd);
+  return path;
+}
+
+// Saves entries with gaps in their ids, reloads them and runs a time range query
+static void testRangeQueryAfterReload()
+{
+  std::string path = tempPath();
+  MetadataWriter writer;
+  writer.add(0, 100, "user", "first");
+  writer.add(1, 200, "assistant", "second", {"a"});
+  writer.add(4, 300, "user", "third");
+  writer.add(5, 400, "user", "fourth", {"a", "b"});
+  writer.add(9, 500, "assistant", "fifth");
+  writer.write(path);
+
+  MetadataStore file;
+  file.open(path);
+  CHECK(file.verify());
+  EntryStore entries;
+  entries.load(file);
+  unlink(path.c_str());
+
+  CHECK(entries.size() == 5);
+  CHECK(entries.endId() == 10);
+  CHECK(entries.timestampsSorted());
+  CHECK(entries.lowerBoundTime(0) == 0);
+  CHECK(entries.lowerBoundTime(200) == 1);
+  CHECK(entries.lowerBoundTime(250) == 2); // the gap before id 4
+  CHECK(entries.lowerBoundTime(400) == 5);
+  CHECK(entries.lowerBoundTime(501) == entries.endId());
+
+  // Entries in [250, 450): scan from the lower bound until the first later timestamp
+  std::string contents;
+  for (long id = entries.lowerBoundTime(250); id < entries.endId() && entries.timestamp(id) < 450; ++id)
+  {
+    if (entries.contains(id))
+      contents += std::string(entries.content(id)) + ";";
+  }
+  CHECK(contents == "third;fourth;");
+  CHECK(entries.tags(5).size() == 2 && entries.tags(5)[1] == "b");
+
+  // A later entry out of order turns the index back into a hint
+  entries.put(10, 50, "user", "late");
+  CHECK(!entries.timestampsSorted());
+}
+
+// Role bitmaps are rebuilt on reload and can be walked from any id
+static void testRoleIds()
+{
+  std::string path = tempPath();
+  MetadataWriter writer;
+  for (long id = 0; id < 200000; ++id)
+    writer.add(id, id, id % 1000 == 0 ? "system" : "user", "");
+  writer.write(path);
+
+  MetadataStore file;
+  file.open(path);
+  EntryStore entries;
+  entries.load(file);
+  unlink(path.c_str());
+
+  const TagBitmap *system = entries.roleIds(entries.findRole("system"));
+  CHECK(system && system->cardinality() == 200);
+  CHECK(entries.roleIds(entries.findRole("user"))->cardinality() == 199800);
+  std::vector<uint32_t> ids;
+  system->forEachFrom(150001, [&](uint32_t id)
+                      { ids.push_back(id);
+                        return ids.size() < 3; });
+  CHECK(ids == std::vector<uint32_t>({151000, 152000, 153000}));
+  ids.clear();
+  entries.roleIds(entries.findRole("user"))->forEachFrom(131999, [&](uint32_t id)
+                                                        { ids.push_back(id);
+                                                          return ids.size() < 2; });
+  CHECK(ids == std::vector<uint32_t>({131999, 132001}));
+}
+
+// Overwrites the second record's field at offset within the record; the file's
+// checksums no longer match, but load() does not rely on verify()
+static void patchSecondRecord(const std::string &path, size_t offset, uint64_t value)
+{
+  std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+  // header, one role slot, then the records
+  file.seekp(sizeof(MetadataHeader) + sizeof(MetadataRoleSlot) + sizeof(MetadataRecord) + offset);
+  file.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// A bad record is rejected before any column is touched
+static void testRejectsInvalidRecords()
+{
+  const std::pair<size_t, uint64_t> patches[] = {
+      {offsetof(MetadataRecord, id), (uint64_t)-5},
+      {offsetof(MetadataRecord, id), 1ull << 40},
+      {offsetof(MetadataRecord, content_offset), 1ull << 40},
+      {offsetof(MetadataRecord, content_offset), UINT64_MAX - 2},
+      {offsetof(MetadataRecord, role), 7},
+  };
+  for (const auto &[offset, value] : patches)
+  {
+    std::string path = tempPath();
+    MetadataWriter writer;
+    writer.add(0, 100, "user", "first");
+    writer.add(1, 200, "user", "second");
+    writer.write(path);
+    patchSecondRecord(path, offset, value);
+
+    MetadataStore file;
+    file.open(path);
+    CHECK(!file.verify());
+    EntryStore entries;
+    entries.put(0, 50, "user", "kept");
+    bool threw = false;
+    try
+    {
+      entries.load(file);
+    }
+    catch (const std::runtime_error &)
+    {
+      threw = true;
+    }
+    unlink(path.c_str());
+    CHECK(threw);
+    CHECK(entries.size() == 1 && entries.endId() == 1 && entries.content(0) == "kept");
+  }
+}
+
+int main()
+{
+  testRangeQueryAfterReload();
+  testRoleIds();
+  testRejectsInvalidRecords();
+  if (failures)
+  {
+    std::cerr << failures << " check(s) failed" << std::endl;
+    return 1;
+  }
+  std::cout << "All EntryStore tests passed" << std::endl;
+  return 0;
+}